@@ -0,0 +1,25 @@
+// A translation unit that only reads parsed arguments, used to time
+// the cost of including cl (see compile_time.sh). CL_BASELINE builds it
+// against the cl.h of an older release, which has no keys.
+
+#if defined(CL_BENCH_FWD)
+#include <cl/cl_fwd.h>
+#else
+#include <cl/cl.h>
+#endif
+
+#if defined(CL_BASELINE)
+#define KEY(k) k
+#else
+#define KEY(k) k##_k
+using namespace cl::string_literals;
+#endif
+
+int run(int argc, char** argv) {
+    cl::Args args = cl::parse(argc, argv);
+
+    if(args[KEY("verbose")])
+        return 1;
+
+    return args[KEY("file")].is_string() ? 0 : 2;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Usage: compile_time.sh CXX INCLUDE_DIR SOURCE [RUNS] [BASELINE]
+# Prints the average time to compile SOURCE with the full header and with
+# the forward header. BASELINE is a git revision whose cl.h is measured
+# first, for reference.
+
+CXX="$1"
+INCLUDE="$2"
+SRC="$3"
+RUNS="${4:-10}"
+BASELINE="$5"
+OUT="$(mktemp -d)"
+
+trap 'rm -rf "$OUT"' EXIT
+
+measure() {
+    name="$1"
+    shift
+
+    "$CXX" "$@" -c "$SRC" -o "$OUT/bench.o" || return 1
+    start=$(date +%s%N)
+    i=0
+
+    while [ "$i" -lt "$RUNS" ]; do
+        "$CXX" "$@" -c "$SRC" -o "$OUT/bench.o"
+        i=$((i + 1))
+    done
+
+    end=$(date +%s%N)
+    echo "$name: $(((end - start) / RUNS / 1000000)) ms"
+}
+
+if [ -n "$BASELINE" ]; then
+    mkdir -p "$OUT/base/cl"
+    git -C "$INCLUDE" show "$BASELINE:include/cl/cl.h" > "$OUT/base/cl/cl.h" ||
+        exit 1
+    measure "cl.h at $BASELINE" -std=c++17 -O2 -I"$OUT/base" -DCL_BASELINE
+fi
+
+measure "cl.h" -std=c++17 -O2 -I"$INCLUDE"
+measure "cl_fwd.h" -std=c++17 -O2 -I"$INCLUDE" -DCL_COMPILED -DCL_BENCH_FWD
+
@@ -0,0 +1,39 @@
+// A small program parsed with cl::Parser<CL_POLICIES>, or with cl::parse()
+// if CL_POLICIES is not defined. CL_BASELINE builds it against the cl.h of
+// an older release, which has no parser.h and no keys (see size_report.sh)
+
+#if defined(CL_BASELINE)
+#include <cl/cl.h>
+#else
+#include <cl/parser.h>
+#endif
+
+using namespace cl::string_literals;
+
+int main(int argc, char** argv) {
+    cl::set_program("size");
+    cl::set_version("1.0");
+
+    cl::Options{
+        cl::opt("v1", "verbose", "Verbose output"),
+        cl::opt("f", "force", "Overwrite files"),
+    };
+
+    cl::Usage{
+        cl::cmd("copy", "src", "dst", *--"force"_p, *--"verbose"_p),
+        cl::cmd("remove", "path", *--"force"_p),
+        cl::cmd("mode", cl::one("fast", "slow")),
+    };
+
+#if defined(CL_POLICIES)
+    cl::Args args = cl::Parser<CL_POLICIES>::parse(argc, argv);
+#else
+    cl::Args args = cl::parse(argc, argv);
+#endif
+
+#if defined(CL_BASELINE)
+    return args["verbose"] == true;
+#else
+    return args["verbose"_k] == true;
+#endif
+}
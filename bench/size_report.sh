@@ -0,0 +1,53 @@
+#!/bin/sh
+# Usage: size_report.sh CXX INCLUDE_DIR SOURCE [BASELINE]
+# Prints the .text size of SOURCE built with cl::parse() and with
+# cl::Parser for every combination of policies. BASELINE is a git revision
+# whose cl.h is measured first, for reference.
+
+CXX="$1"
+INCLUDE="$2"
+SRC="$3"
+BASELINE="$4"
+OUT="$(mktemp -d)"
+FLAGS="-std=c++17 -Os -ffunction-sections -fdata-sections -Wl,--gc-sections -s"
+POLICIES="NoHelp NoMessages NoEntry NoBatch NoCompletion FlagsOnly"
+
+trap 'rm -rf "$OUT"' EXIT
+
+text_size() {
+    # shellcheck disable=SC2086
+    "$CXX" $FLAGS -I"${DIR:-$INCLUDE}" "$@" "$SRC" -o "$OUT/size" || exit 1
+    size -A "$OUT/size" | awk '$1 == ".text" { print $2 }'
+}
+
+printf "%8s  %s\n" ".text" "parser"
+
+if [ -n "$BASELINE" ]; then
+    mkdir -p "$OUT/base/cl"
+    git -C "$INCLUDE" show "$BASELINE:include/cl/cl.h" > "$OUT/base/cl/cl.h" ||
+        exit 1
+    printf "%8s  %s\n" "$(DIR="$OUT/base" text_size -DCL_BASELINE)" \
+        "cl::parse() at $BASELINE"
+fi
+
+printf "%8s  %s\n" "$(text_size)" "cl::parse()"
+
+n=$(echo "$POLICIES" | wc -w)
+mask=0
+
+while [ "$mask" -lt $((1 << n)) ]; do
+    list=""
+    i=0
+
+    for p in $POLICIES; do
+        if [ $(((mask >> i) & 1)) -eq 1 ]; then
+            list="${list:+$list, }cl::$p"
+        fi
+
+        i=$((i + 1))
+    done
+
+    printf "%8s  %s\n" "$(text_size -D"CL_POLICIES=$list")" \
+        "cl::Parser<$list>"
+    mask=$((mask + 1))
+done
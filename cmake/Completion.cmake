@@ -0,0 +1,45 @@
+# cl_add_completion(<target> [SHELLS bash zsh fish] [DESTINATION <dir>])
+# Runs <target> --cl-completion=<shell> after each build and writes the
+# script to <dir>/<target>.<shell> (default: ${CMAKE_CURRENT_BINARY_DIR}).
+# <target> must call cl::enable_builtins() before cl::parse(argc, argv).
+
+if(CMAKE_SCRIPT_MODE_FILE)
+    # cmake -DPROGRAM=... -DSHELL=... -DOUTPUT=... -P Completion.cmake
+    execute_process(
+        COMMAND "${PROGRAM}" --cl-completion=${SHELL}
+        OUTPUT_FILE "${OUTPUT}"
+        RESULT_VARIABLE result
+    )
+
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${PROGRAM} --cl-completion=${SHELL} failed")
+    endif()
+
+    return()
+endif()
+
+set(CL_COMPLETION_FILE "${CMAKE_CURRENT_LIST_FILE}" CACHE INTERNAL "")
+
+function(cl_add_completion target)
+    cmake_parse_arguments(ARG "" "DESTINATION" "SHELLS" ${ARGN})
+
+    if(NOT ARG_SHELLS)
+        set(ARG_SHELLS bash zsh fish)
+    endif()
+
+    if(NOT ARG_DESTINATION)
+        set(ARG_DESTINATION "${CMAKE_CURRENT_BINARY_DIR}")
+    endif()
+
+    foreach(shell ${ARG_SHELLS})
+        add_custom_command(TARGET ${target} POST_BUILD
+            COMMAND
+                ${CMAKE_COMMAND}
+                    -DPROGRAM=$<TARGET_FILE:${target}>
+                    -DSHELL=${shell}
+                    -DOUTPUT=${ARG_DESTINATION}/${target}.${shell}
+                    -P ${CL_COMPLETION_FILE}
+            VERBATIM
+        )
+    endforeach()
+endfunction()
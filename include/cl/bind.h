@@ -0,0 +1,306 @@
+/*
+ *  _____  _
+ * /  __ \| |      Easy command line parsing with EDSL
+ * | /  \/| |      Binding parsed values to user structs
+ * | |    | |
+ * | \__/\| |____  https://github.com/Dax89/cl
+ *  \____/\_____/
+ *
+ * License: MIT
+ * https://github.com/Dax89/cl/blob/master/LICENSE
+ */
+
+#pragma once
+
+#include <charconv>
+#include <cl/cl.h>
+#include <optional>
+#include <tuple>
+
+namespace cl {
+
+namespace impl {
+
+template<typename T>
+struct is_optional: std::false_type {};
+
+template<typename T>
+struct is_optional<std::optional<T>>: std::true_type {};
+
+// Converts 'arg' into 'm', returns false if it is not possible
+template<typename M>
+bool assign(M& m, const Arg& arg) {
+    if constexpr(is_optional<M>::value) {
+        typename M::value_type v{};
+
+        if(!impl::assign(v, arg))
+            return false;
+
+        m = std::move(v);
+    }
+    else if constexpr(std::is_same_v<M, bool>)
+        m = !arg.is_bool() || arg.to_bool(); // Commands are bound as 'true'
+    else if constexpr(std::is_same_v<M, std::string_view> ||
+                      std::is_same_v<M, std::string>) {
+        if(!arg.is_string())
+            return false;
+
+        m = M{arg.to_stringview()};
+    }
+    else if constexpr(std::is_arithmetic_v<M>) {
+        if(!arg.is_string())
+            return false;
+
+        std::string_view v = arg.to_stringview();
+        auto [p, ec] = std::from_chars(v.data(), v.data() + v.size(), m);
+        return ec == std::errc{} && p == v.data() + v.size();
+    }
+    else
+        static_assert(Arg::always_false_v<M>, "Unsupported member type");
+
+    return true;
+}
+
+} // namespace impl
+
+// Binds the member 'member' of 'T' to an argument
+template<typename T, typename M>
+struct Binding {
+    void resolve() {
+        slot = handle.slot ? handle.get() : impl::layout.index.find(key);
+    }
+
+    bool assign(T& obj, const Arg& arg) const {
+        return impl::assign(obj.*member, arg);
+    }
+
+    M T::*member;
+    Key key;
+    Handle handle;
+    uint32_t slot{Handle::NO_SLOT};
+};
+
+// String keys are kept as views, they must outlive the binding
+template<typename T, typename M>
+Binding<T, M> bind(M T::*member, const Key& key) {
+    return {member, key, {}};
+}
+
+template<typename T, typename M>
+Binding<T, M> bind(M T::*member, const Handle& h) {
+    return {member, Key{""}, h};
+}
+
+/*
+ * A set of bindings for 'T', optionally restricted to a command.
+ * Keys are resolved to slots once per grammar, then values are written
+ * to the struct without building Args or hashing strings.
+ */
+template<typename T, typename... Bindings>
+struct Binder {
+    using type = T;
+
+    void resolve() {
+        if(resolved && grammar == impl::layout.fingerprint)
+            return;
+
+        std::apply([](auto&... b) { (b.resolve(), ...); }, bindings);
+
+        if(command.slot)
+            commandslot = command.get();
+        else if(!commandkey.name.empty())
+            commandslot = impl::layout.index.find(commandkey);
+
+        grammar = impl::layout.fingerprint;
+        resolved = true;
+    }
+
+    // True if the matched command is the one bound (or none is bound)
+    [[nodiscard]] bool accepts(const impl::Cmd& cmd) const {
+        if(!command.slot && commandkey.name.empty())
+            return true;
+
+        return *cmd.slot == commandslot;
+    }
+
+    // Values not given in the command line leave members untouched
+    Error fill(const impl::Scratch& scratch, T& obj) const {
+        Error err;
+
+        impl::fill(scratch, [&](uint32_t slot, const Arg& arg, int index) {
+            auto set = [&](auto& b) {
+                if(b.slot != slot || b.assign(obj, arg) ||
+                   err.code != ErrorCode::NONE)
+                    return;
+
+                err = Error{ErrorCode::INVALID_VALUE, index,
+                            arg.is_string() ? arg.to_stringview()
+                                            : std::string_view{}};
+            };
+
+            std::apply([&](auto&... b) { (set(b), ...); }, bindings);
+        });
+
+        return err;
+    }
+
+    Key commandkey{""};
+    Handle command;
+    std::tuple<Bindings...> bindings;
+    uint32_t commandslot{Handle::NO_SLOT};
+    uint64_t grammar{0};
+    bool resolved{false};
+};
+
+template<typename T, typename... Bindings>
+Binder<T, Bindings...> binder(Bindings... b) {
+    return {Key{""}, {}, {std::move(b)...}};
+}
+
+// Binder used by parse_as() when the command 'name' is matched
+template<typename T, typename... Bindings>
+Binder<T, Bindings...> command(const Key& name, Bindings... b) {
+    return {name, {}, {std::move(b)...}};
+}
+
+template<typename T, typename... Bindings>
+Binder<T, Bindings...> command(const Handle& cmd, Bindings... b) {
+    return {Key{""}, cmd, {std::move(b)...}};
+}
+
+namespace impl {
+
+template<typename Tokens, typename B>
+Result<typename B::type> parse_into(Tokens& tokens, B& binder) {
+    Scratch scratch;
+    Error err = impl::match(tokens, scratch);
+
+    if(err.code == ErrorCode::NONE && scratch.command)
+        err = impl::check_values(scratch);
+    if(err.code != ErrorCode::NONE)
+        return err;
+
+    typename B::type obj{};
+
+    if(!scratch.command)
+        return obj;
+
+    binder.resolve();
+
+    if(!binder.accepts(*scratch.command)) {
+        return Error{ErrorCode::UNKNOWN_COMMAND, scratch.name.index,
+                     scratch.name.val};
+    }
+
+    err = binder.fill(scratch, obj);
+
+    if(err.code != ErrorCode::NONE)
+        return err;
+
+    return obj;
+}
+
+template<typename Tokens, typename... Binders>
+Result<std::variant<typename Binders::type...>> parse_as(Tokens& tokens,
+                                                         Binders&... binders) {
+    using Variant = std::variant<typename Binders::type...>;
+
+    Scratch scratch;
+    Error err = impl::match(tokens, scratch);
+
+    if(err.code == ErrorCode::NONE && scratch.command)
+        err = impl::check_values(scratch);
+    if(err.code != ErrorCode::NONE)
+        return err;
+
+    err = Error{ErrorCode::UNKNOWN_COMMAND, scratch.name.index,
+                scratch.name.val};
+
+    std::optional<Variant> res;
+
+    // The first binder accepting the matched command wins
+    auto tryfill = [&](auto& b) {
+        if(res || !scratch.command)
+            return;
+
+        b.resolve();
+
+        if(!b.accepts(*scratch.command))
+            return;
+
+        typename std::decay_t<decltype(b)>::type obj{};
+        err = b.fill(scratch, obj);
+
+        if(err.code == ErrorCode::NONE)
+            res.emplace(std::move(obj));
+    };
+
+    (tryfill(binders), ...);
+
+    if(res)
+        return std::move(*res);
+
+    return err;
+}
+
+} // namespace impl
+
+/*
+ * Parses straight into a 'T' built by value-initialization: members
+ * keep their initializers unless a value is given in the command line.
+ * Command entries are not called.
+ */
+template<typename T, typename... Bindings>
+Result<T> try_parse_into(int argc, char** argv,
+                         Binder<T, Bindings...>& binder) {
+    impl::ArgvTokens tokens{argc, argv};
+    return impl::parse_into(tokens, binder);
+}
+
+// The buffer is unescaped in place, string_view members refer to it
+template<typename T, typename... Bindings>
+Result<T> try_parse_into(std::string& line, Binder<T, Bindings...>& binder) {
+    impl::LineTokens tokens{line.data(), line.data() + line.size()};
+    return impl::parse_into(tokens, binder);
+}
+
+template<typename T, typename... Bindings>
+T parse_into(int argc, char** argv, Binder<T, Bindings...>& binder) {
+    Result<T> res = cl::try_parse_into(argc, argv, binder);
+
+    if(!res)
+        impl::fail(res.error());
+
+    return std::move(*res);
+}
+
+/*
+ * Returns the struct bound to the matched command (see cl::command()),
+ * command lines matching a command without binders are rejected.
+ */
+template<typename... Binders>
+Result<std::variant<typename Binders::type...>>
+try_parse_as(int argc, char** argv, Binders&... binders) {
+    impl::ArgvTokens tokens{argc, argv};
+    return impl::parse_as(tokens, binders...);
+}
+
+template<typename... Binders>
+Result<std::variant<typename Binders::type...>>
+try_parse_as(std::string& line, Binders&... binders) {
+    impl::LineTokens tokens{line.data(), line.data() + line.size()};
+    return impl::parse_as(tokens, binders...);
+}
+
+template<typename... Binders>
+std::variant<typename Binders::type...> parse_as(int argc, char** argv,
+                                                 Binders&... binders) {
+    auto res = cl::try_parse_as(argc, argv, binders...);
+
+    if(!res)
+        impl::fail(res.error());
+
+    return std::move(*res);
+}
+
+} // namespace cl
@@ -0,0 +1,325 @@
+/*
+ *  _____  _
+ * /  __ \| |      Easy command line parsing with EDSL
+ * | /  \/| |      Memoizing cache of parse results
+ * | |    | |
+ * | \__/\| |____  https://github.com/Dax89/cl
+ *  \____/\_____/
+ *
+ * License: MIT
+ * https://github.com/Dax89/cl/blob/master/LICENSE
+ */
+
+#pragma once
+
+#include <cl/cl.h>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace cl {
+
+/*
+ * A parse result owning the text it refers to, shared by every lookup of
+ * the same command line: it is immutable and can be used by many threads.
+ */
+struct CachedParse {
+    explicit operator bool() const { return error.code == ErrorCode::NONE; }
+
+    // Calls the matched command entry, if any
+    void operator()() const {
+        if(command && command->entry)
+            command->entry(args);
+    }
+
+    std::unique_ptr<char[]> text; // The key, then the unescaped line
+    size_t keysize{0};
+    bool argv{false}; // Key is argv[1..argc), each followed by '\0'
+    std::vector<char*> pointers; // Into 'text', NULL terminated: Args::rest
+    uint64_t hash{0};
+    uint64_t grammar{0};
+    size_t size{0}; // Bytes charged to the cache
+    Args args;
+    Error error; // Refers to 'text'
+    const impl::Cmd* command{nullptr};
+};
+
+using CachedResult = std::shared_ptr<const CachedParse>;
+
+struct CacheStats {
+    uint64_t hits{0};
+    uint64_t misses{0};
+    size_t entries{0};
+    size_t size{0}; // Bytes
+};
+
+namespace impl {
+
+// List and hash nodes, shared_ptr control block (approximated)
+constexpr size_t CACHE_NODE_SIZE = 12 * sizeof(void*);
+
+inline uint64_t hash_argv(int argc, char** argv) {
+    uint64_t h = HASH_OFFSET;
+
+    for(int i = 1; i < argc; i++)
+        h = impl::hash({argv[i], std::strlen(argv[i]) + 1}, h);
+
+    return h;
+}
+
+inline bool equals_argv(const CachedParse& e, int argc, char** argv) {
+    const char* p = e.text.get();
+    const char* end = p + e.keysize;
+
+    for(int i = 1; i < argc; i++) {
+        size_t n = std::strlen(argv[i]) + 1;
+
+        if(static_cast<size_t>(end - p) < n || std::memcmp(p, argv[i], n))
+            return false;
+
+        p += n;
+    }
+
+    return p == end;
+}
+
+// Least recently used entries are evicted first
+struct CacheShard {
+    using Lru = std::list<CachedResult>;
+
+    template<typename Equals>
+    CachedResult find(uint64_t h, bool argv, Equals&& equals) {
+        auto [b, e] = index.equal_range(h);
+
+        for(auto it = b; it != e; ++it) {
+            const CachedParse& entry = **it->second;
+
+            if(entry.argv != argv || entry.grammar != layout.fingerprint ||
+               !equals(entry))
+                continue;
+
+            lru.splice(lru.begin(), lru, it->second);
+            ++hits;
+            return *it->second;
+        }
+
+        ++misses;
+        return nullptr;
+    }
+
+    // Returns the entry already cached by a concurrent miss, if any
+    CachedResult insert(const CachedResult& entry, size_t capacity) {
+        auto [b, e] = index.equal_range(entry->hash);
+
+        for(auto it = b; it != e; ++it) {
+            const CachedParse& other = **it->second;
+
+            if(other.argv == entry->argv && other.keysize == entry->keysize &&
+               other.grammar == entry->grammar &&
+               !std::memcmp(other.text.get(), entry->text.get(),
+                            entry->keysize))
+                return *it->second;
+        }
+
+        if(entry->size > capacity)
+            return entry;
+
+        lru.push_front(entry);
+        index.emplace(entry->hash, lru.begin());
+        size += entry->size;
+
+        while(size > capacity)
+            this->erase(std::prev(lru.end()));
+
+        return entry;
+    }
+
+    void erase(Lru::iterator it) {
+        auto [b, e] = index.equal_range((*it)->hash);
+
+        for(auto i = b; i != e; ++i) {
+            if(i->second == it) {
+                index.erase(i);
+                break;
+            }
+        }
+
+        size -= (*it)->size;
+        lru.erase(it);
+    }
+
+    std::mutex mutex;
+    Lru lru;
+    std::unordered_multimap<uint64_t, Lru::iterator> index;
+    size_t size{0};
+    uint64_t hits{0};
+    uint64_t misses{0};
+};
+
+} // namespace impl
+
+/*
+ * Bounded cache of parse results, keyed by the hash of the command line
+ * (or of the argv tokens): a hit skips tokenization, matching and
+ * init_value() and returns the shared result. Failed parses are cached
+ * too. Entries are spread over independently locked shards, 'capacity'
+ * (in bytes) is split between them.
+ * Command entries are not called, CachedParse::operator() does it.
+ * The grammar is finalized on construction, entries taken with another
+ * grammar are never returned.
+ * Results of commands with a Validator are not cached: a validator may
+ * depend on more than the line (eg. whether a file exists), so they are
+ * parsed and checked again on every call.
+ */
+struct ParseCache {
+    static constexpr size_t DEFAULT_SHARDS = 16;
+
+    explicit ParseCache(size_t capacity, size_t nshards = DEFAULT_SHARDS)
+        : shards{nshards ? nshards : 1},
+          shardcapacity{capacity / shards.size()} {
+        impl::finalize();
+    }
+
+    ParseCache(const ParseCache&) = delete;
+    ParseCache& operator=(const ParseCache&) = delete;
+
+    CachedResult try_parse(std::string_view line) {
+        uint64_t h = impl::hash(line);
+        impl::CacheShard& shard = this->shard(h);
+
+        {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+
+            CachedResult res =
+                shard.find(h, false, [line](const CachedParse& e) {
+                    return std::string_view{e.text.get(), e.keysize} == line;
+                });
+
+            if(res)
+                return res;
+        }
+
+        auto e = std::make_shared<CachedParse>();
+        e->text = std::make_unique<char[]>(line.size() * 2 + 1);
+        e->keysize = line.size();
+        e->hash = h;
+
+        char* copy = e->text.get() + line.size();
+        std::memcpy(e->text.get(), line.data(), line.size());
+        std::memcpy(copy, line.data(), line.size());
+
+        impl::LineTokens tokens{copy, copy + line.size()};
+        return this->insert(shard, std::move(e), tokens);
+    }
+
+    // argv[0] is not part of the key
+    CachedResult try_parse(int argc, char** argv) {
+        uint64_t h = impl::hash_argv(argc, argv);
+        impl::CacheShard& shard = this->shard(h);
+
+        {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+
+            CachedResult res =
+                shard.find(h, true, [argc, argv](const CachedParse& e) {
+                    return impl::equals_argv(e, argc, argv);
+                });
+
+            if(res)
+                return res;
+        }
+
+        auto e = std::make_shared<CachedParse>();
+        std::vector<char*>& copy = e->pointers;
+        copy.resize(static_cast<size_t>(std::max(argc, 1)) + 1);
+
+        for(int i = 1; i < argc; i++)
+            e->keysize += std::strlen(argv[i]) + 1;
+
+        e->text = std::make_unique<char[]>(e->keysize + 1);
+        e->argv = true;
+        e->hash = h;
+
+        char* p = e->text.get();
+
+        for(int i = 1; i < argc; i++) {
+            size_t n = std::strlen(argv[i]) + 1;
+            copy[i] = p;
+            std::memcpy(p, argv[i], n);
+            p += n;
+        }
+
+        impl::ArgvTokens tokens{argc, copy.data()};
+        return this->insert(shard, std::move(e), tokens);
+    }
+
+    [[nodiscard]] CacheStats stats() {
+        CacheStats s;
+
+        for(impl::CacheShard& shard : shards) {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            s.hits += shard.hits;
+            s.misses += shard.misses;
+            s.entries += shard.lru.size();
+            s.size += shard.size;
+        }
+
+        return s;
+    }
+
+    void clear() {
+        for(impl::CacheShard& shard : shards) {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            shard.lru.clear();
+            shard.index.clear();
+            shard.size = 0;
+        }
+    }
+
+private:
+    // FNV-1a barely changes the high bits for short keys, they are mixed
+    // first (MurmurHash3 finalizer)
+    impl::CacheShard& shard(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        return shards[h % shards.size()];
+    }
+
+    // Parses outside of the lock, concurrent misses may parse twice
+    template<typename Tokens>
+    CachedResult insert(impl::CacheShard& shard,
+                        std::shared_ptr<CachedParse> e, Tokens& tokens) {
+        impl::Scratch scratch;
+        Result<Args> res = impl::parse(tokens, scratch);
+
+        // Entries are read by many threads, nothing is left to compute
+        if(res) {
+            e->args = std::move(*res);
+            e->args.resolve();
+            e->command = scratch.command;
+        }
+        else
+            e->error = res.error();
+
+        // Not cached, see ParseCache
+        if(scratch.command && impl::signature(*scratch.command).validated)
+            return e;
+
+        size_t textsize = e->argv ? e->keysize + 1 : e->keysize * 2 + 1;
+        e->grammar = impl::layout.fingerprint;
+        e->size = sizeof(CachedParse) + impl::CACHE_NODE_SIZE + textsize +
+                  e->args.values.capacity() * sizeof(Arg) +
+                  e->pointers.capacity() * sizeof(char*);
+
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        return shard.insert(e, shardcapacity);
+    }
+
+    std::vector<impl::CacheShard> shards;
+    size_t shardcapacity;
+};
+
+} // namespace cl
@@ -12,25 +12,424 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cl/cl_fwd.h>
+#include <cstring>
 #include <functional>
+#include <memory>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <tuple>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <variant>
 #include <vector>
 
+// Entry points declared in cl_fwd.h are defined only once with CL_COMPILED
+#if !defined(CL_COMPILED) || defined(CL_IMPLEMENTATION)
+#define CL_DEFINE_API
+#endif
+
 namespace cl {
 
+/*
+ * Refers to an argument by its slot: it is taken from a declaration
+ * (option, command, parameter or choice) and resolved when the grammar
+ * is finalized, then Args lookups are plain array accesses.
+ */
+struct Handle {
+    static constexpr uint32_t NO_SLOT = ~0U;
+
+    [[nodiscard]] uint32_t get() const { return slot ? *slot : NO_SLOT; }
+
+    std::shared_ptr<const uint32_t> slot;
+};
+
+// Default value of an option computed on first read, see cl::opt()
+using DefaultValue = std::function<std::string()>;
+
+// Checks a value, returns why it is rejected or an empty string
+using Validator = std::function<std::string(std::string_view)>;
+
+namespace impl {
+
+/*
+ * Flat open-addressing (linear probing) table from keys to slots, built
+ * once per grammar: its capacity is fixed at twice the number of keys and
+ * the seed is the one giving the shortest probe sequences.
+ */
+struct KeyTable {
+    static constexpr uint64_t FIBONACCI = 0x9E3779B97F4A7C15ULL;
+    static constexpr size_t MIN_BITS = 3;
+    static constexpr size_t SEEDS = 8;
+
+    struct Bucket {
+        uint64_t hash{0};
+        std::string_view key{};
+        uint32_t slot{Handle::NO_SLOT};
+    };
+
+    void clear() {
+        buckets.clear();
+        maxprobe = 0;
+    }
+
+    [[nodiscard]] size_t position(uint64_t h) const {
+        return static_cast<size_t>(((h ^ seed) * FIBONACCI) >> (64 - bits));
+    }
+
+    [[nodiscard]] uint32_t find(const Key& k) const {
+        if(buckets.empty())
+            return Handle::NO_SLOT;
+
+        size_t mask = buckets.size() - 1;
+        size_t i = this->position(k.hash);
+
+        for(size_t n = 0; n <= maxprobe; n++, i = (i + 1) & mask) {
+            const Bucket& b = buckets[i];
+
+            if(b.slot == Handle::NO_SLOT)
+                break;
+            if(b.hash == k.hash && b.key == k.name)
+                return b.slot;
+        }
+
+        return Handle::NO_SLOT;
+    }
+
+    // Keys must be unique, their index is the slot
+    void build(const std::vector<std::string_view>& keys) {
+        bits = MIN_BITS;
+
+        while((size_t{1} << bits) < keys.size() * 2)
+            ++bits;
+
+        std::vector<Bucket> best;
+        size_t bestprobe = ~size_t{0};
+        uint64_t bestseed = 0;
+
+        for(size_t i = 0; i < SEEDS && bestprobe; i++) {
+            seed = i * FIBONACCI;
+            this->fill(keys);
+
+            if(maxprobe < bestprobe) {
+                best.swap(buckets);
+                bestprobe = maxprobe;
+                bestseed = seed;
+            }
+        }
+
+        buckets.swap(best);
+        maxprobe = bestprobe;
+        seed = bestseed;
+    }
+
+    std::vector<Bucket> buckets;
+    uint64_t seed{0};
+    size_t bits{MIN_BITS};
+    size_t maxprobe{0};
+
+private:
+    void fill(const std::vector<std::string_view>& keys) {
+        buckets.assign(size_t{1} << bits, Bucket{});
+        maxprobe = 0;
+
+        size_t mask = buckets.size() - 1;
+
+        for(size_t slot = 0; slot < keys.size(); slot++) {
+            Key k{keys[slot]};
+            size_t i = this->position(k.hash), n = 0;
+
+            for(; buckets[i].slot != Handle::NO_SLOT; n++)
+                i = (i + 1) & mask;
+
+            buckets[i] = {k.hash, k.name, static_cast<uint32_t>(slot)};
+            maxprobe = std::max(maxprobe, n);
+        }
+    }
+};
+
+// One bit per option or slot, sized once per grammar
+struct Bitset {
+    void reset(size_t n) { words.assign((n + 63) / 64, 0); }
+    void set(size_t i) { words[i >> 6] |= uint64_t{1} << (i & 63); }
+    void unset(size_t i) { words[i >> 6] &= ~(uint64_t{1} << (i & 63)); }
+
+    [[nodiscard]] bool empty() const { return words.empty(); }
+
+    [[nodiscard]] bool test(size_t i) const {
+        return (i >> 6) < words.size() && ((words[i >> 6] >> (i & 63)) & 1);
+    }
+
+    // Bits set in both
+    [[nodiscard]] size_t count(const Bitset& rhs) const {
+        size_t n = 0;
+        size_t size = std::min(words.size(), rhs.words.size());
+
+        for(size_t i = 0; i < size; i++) {
+            for(uint64_t w = words[i] & rhs.words[i]; w; w &= w - 1)
+                ++n;
+        }
+
+        return n;
+    }
+
+    [[nodiscard]] bool subset_of(const Bitset& rhs) const {
+        for(size_t i = 0; i < words.size(); i++) {
+            uint64_t w = i < rhs.words.size() ? rhs.words[i] : 0;
+
+            if(words[i] & ~w)
+                return false;
+        }
+
+        return true;
+    }
+
+    std::vector<uint64_t> words;
+};
+
+/*
+ * A command compiled when the grammar is finalized, so that a command
+ * line is accepted or rejected with a few comparisons and bit operations.
+ */
+struct Signature {
+    size_t minargs{0};
+    size_t maxargs{0};
+    Bitset allowed;                // Option ids
+    Bitset required;               // Option ids
+    std::vector<Bitset> choices;   // Valid slots per positional, empty if any
+    std::vector<uint32_t> options; // Option id of each Cmd::options entry
+    std::vector<uint32_t> rules;   // Constraints that apply, layout.rules
+    Bitset lazy;                   // Slots with a lazy default, if any
+    bool validated{false};         // Some values have a Validator
+};
+
+enum class RuleKind {
+    AT_MOST_ONE,
+    EXACTLY_ONE,
+    AT_LEAST_ONE,
+    DEPENDS, // 'option' needs every option of the mask
+};
+
+// A Rules entry compiled when the grammar is finalized
+struct Constraint {
+    RuleKind kind;
+    uint32_t option; // DEPENDS only
+    Bitset mask;     // Option ids
+    const Rule* rule;
+};
+
+/*
+ * An option family compiled when the grammar is finalized: names are
+ * bits, each family has 'words' words of given bits in Args::flags
+ * followed by as many words of enabled bits.
+ */
+struct FamilyTable {
+    std::string_view prefix;
+    uint32_t option; // Options::items index
+    uint32_t slot;   // Option id
+    size_t offset;   // First word in Args::flags
+    size_t words;
+    bool open;      // Names not in the table are accepted too
+    KeyTable index; // Name to bit
+};
+
+// Names sorted for prefix searches, with their index
+using SortedNames = std::vector<std::pair<std::string_view, uint32_t>>;
+
+/*
+ * The symbol table: every name of the grammar is interned when it is
+ * finalized and gets a dense id, which is also its slot in Args.
+ * Commands, their positionals and choices come first, then options.
+ * Per-symbol data is stored in parallel arrays indexed by id.
+ */
+struct Layout {
+    std::vector<std::string_view> names; // Symbol names
+    std::vector<Arg> defaults;           // Default values in Args
+    std::vector<uint32_t> commands;      // Usage::items index or NO_SLOT
+    std::vector<uint32_t> options;       // Options::items index or NO_SLOT
+    KeyTable index;                      // Name to id
+
+    std::vector<std::string_view> shortnames; // Option short names
+    std::vector<uint32_t> shortoptions;       // Options::items index
+    KeyTable shortindex;
+
+    SortedNames longnames; // Option names, Options::items index
+    SortedNames cmdnames;  // Named commands, Usage::items index
+
+    std::vector<FamilyTable> families; // Longest prefixes first
+    size_t flagwords{0};               // Size of Args::flags
+
+    std::vector<const DefaultValue*> lazydefaults; // Per id, null if none
+    Bitset lazy;                                   // Ids with a lazy default
+
+    std::vector<uint32_t> builtins;    // '--help' and '--version' options
+    std::vector<uint32_t> anys;        // Any-commands, in declaration order
+    std::vector<Signature> signatures; // One per Usage::items entry
+    std::vector<Constraint> rules;     // One per Rules::items entry
+    uint64_t fingerprint{0};
+    bool dirty{true};
+};
+
+inline Layout layout;
+
+} // namespace impl
+
+
+// Args members reading the symbol table, declared in cl_fwd.h
+inline Arg& Args::operator[](const Handle& h) {
+    uint32_t slot = h.get();
+
+    if(slot < values.size())
+        return this->get(slot);
+
+    none = Arg{};
+    return none;
+}
+
+inline const Arg& Args::operator[](const Handle& h) const {
+    uint32_t slot = h.get();
+    return slot < values.size() ? this->get(slot) : NONE;
+}
+
+template<typename A>
+ArgsIterator<A> Args::at_slot(A* values, size_t slot) {
+    return {values + slot, impl::layout.names.data() + slot};
+}
+
+namespace impl {
+
+struct Computed::Node {
+    std::atomic<size_t> refs{1};
+    std::string value;
+    Node* next{nullptr};
+};
+
+} // namespace impl
+
+#if defined(CL_DEFINE_API)
+CL_API Args::iterator Args::begin() {
+    this->resolve();
+    return {values.data(), impl::layout.names.data()};
+}
+
+CL_API Args::iterator Args::end() {
+    return Args::at_slot(values.data(), this->length());
+}
+
+CL_API Args::const_iterator Args::begin() const {
+    this->resolve();
+    return {std::as_const(values).data(), impl::layout.names.data()};
+}
+
+CL_API Args::const_iterator Args::end() const {
+    return Args::at_slot(std::as_const(values).data(), this->length());
+}
+
+CL_API Args::const_iterator Args::find(const Key& key) const {
+    size_t slot = this->slot(key);
+
+    if(slot >= this->length())
+        return this->end();
+
+    this->get(slot);
+    return Args::at_slot(std::as_const(values).data(), slot);
+}
+
+CL_API size_t Args::slot(const Key& key) const {
+    return impl::layout.index.find(key);
+}
+
+CL_API std::optional<bool> Args::flag(const Key& family,
+                                      const Key& name) const {
+    size_t slot = this->slot(family);
+
+    for(const impl::FamilyTable& f : impl::layout.families) {
+        if(f.slot != slot)
+            continue;
+
+        uint32_t bit = f.index.find(name);
+
+        if(bit != Handle::NO_SLOT) {
+            size_t w = f.offset + (bit >> 6);
+
+            if(w + f.words >= flags.size() || !((flags[w] >> (bit & 63)) & 1))
+                return std::nullopt;
+
+            return (flags[w + f.words] >> (bit & 63)) & 1;
+        }
+
+        for(auto it = others.rbegin(); it != others.rend(); ++it) {
+            if(it->slot == slot && it->name == name.name)
+                return it->enabled;
+        }
+
+        break;
+    }
+
+    return std::nullopt;
+}
+
+CL_API void Args::compute(size_t slot) const {
+    pending[slot >> 6] &= ~(uint64_t{1} << (slot & 63));
+
+    // Given options are not null, only absent ones are computed
+    if(values[slot].is_null())
+        values[slot] = Arg{computed.add((*impl::layout.lazydefaults[slot])())};
+}
+
+CL_API size_t Args::length() const {
+    return std::min(values.size(), impl::layout.names.size());
+}
+
+CL_API impl::Computed::Computed(const Computed& rhs): head{rhs.head} {
+    if(head)
+        ++head->refs;
+}
+
+CL_API impl::Computed& impl::Computed::operator=(const Computed& rhs) {
+    Computed c{rhs};
+    std::swap(head, c.head);
+    return *this;
+}
+
+CL_API impl::Computed::~Computed() {
+    while(head && --head->refs == 0) {
+        Node* next = head->next;
+        delete head;
+        head = next;
+    }
+}
+
+CL_API std::string_view impl::Computed::add(std::string s) {
+    auto* n = new Node{};
+    n->value = std::move(s);
+    n->next = head;
+    head = n;
+    return n->value;
+}
+#endif
+
 inline bool help_on_exit = true;
+inline bool abbreviations = false; // Unique prefixes of commands and options
+inline bool reject_ambiguous = false; // Usage exits on overlapping _a commands
 
 namespace impl {
 
+// Shared between a declaration, its copies and its handles
+using Slot = std::shared_ptr<uint32_t>;
+
+inline Slot make_slot() { return std::make_shared<uint32_t>(Handle::NO_SLOT); }
+
 constexpr std::string_view PROGRAM_DEFAULT = "program";
 
 inline std::string_view strip_dash(std::string_view v) {
@@ -68,6 +467,22 @@ template<typename... Ts>
     std::exit(2);
 }
 
+template<typename... Ts>
+std::string concat(Ts&&... args) {
+    std::array<std::string_view, sizeof...(Ts)> arr{args...};
+    std::string res;
+
+    for(std::string_view a : arr)
+        res += a;
+
+    return res;
+}
+
+struct Token {
+    std::string_view val;
+    int index;
+};
+
 struct OptParam {
     OptParam(const char* n): val{n}, flag{true} {}; // NOLINT
     OptParam(std::string_view n, bool f): val{n}, flag{f} {}
@@ -81,6 +496,12 @@ struct Opt {
     std::string_view name;
     std::string_view description;
     bool flag;
+    Slot slot{impl::make_slot()};
+
+    // Names of an option family, empty for any name (see cl::family())
+    std::shared_ptr<const std::vector<std::string_view>> family;
+
+    DefaultValue lazydefault; // See cl::opt()
 
     explicit Opt(std::string_view s, const OptParam& n, std::string_view d = {})
         : shortname{s}, name{n.val}, flag{n.flag}, description{d} {
@@ -94,14 +515,19 @@ struct Opt {
             impl::print_and_exit("Option name is empty");
     };
 
+    operator Handle() const { return Handle{slot}; } // NOLINT
+
     [[nodiscard]] std::string to_short_string() const {
-        if(shortname.empty())
+        if(shortname.empty() || family)
             return std::string{};
 
         return "-" + std::string{shortname};
     }
 
     [[nodiscard]] std::string to_string() const {
+        if(family)
+            return impl::concat("-", shortname, "[no-]<", name, ">");
+
         std::string res{name};
         if(!flag)
             res += "=ARG";
@@ -128,15 +554,44 @@ struct Base {
 struct Param: public Base<Param> {
     explicit Param(std::string_view arg): Base<Param>{}, val{arg} {}
 
+    // Options refer to the option's slot
+    operator Handle() const { return Handle{slot}; } // NOLINT
+
+    // Checks the given value, flags are never checked
+    Param& operator>>(Validator&& rhs) {
+        validator = std::move(rhs);
+        return *this;
+    }
+
     std::string_view val;
+    Slot slot{impl::make_slot()};
+    Validator validator{nullptr};
+};
+
+// Checks each argument after '--', see cl::rest()
+struct RestParam {
+    Validator validator;
 };
 
 struct One: public Base<One> {
     One(std::initializer_list<std::string_view> args)
-        : Base<One>{}, items{args} {}
+        : Base<One>{}, items{args} {
+        for(size_t i = 0; i < items.size(); i++)
+            slots.push_back(impl::make_slot());
+    }
 
     One& operator--() = delete;
 
+    // Handle of a choice
+    Handle operator[](std::string_view arg) const {
+        for(size_t i = 0; i < items.size(); i++) {
+            if(items[i] == arg)
+                return Handle{slots[i]};
+        }
+
+        return Handle{};
+    }
+
     [[nodiscard]] bool contains(std::string_view arg) const {
         for(std::string_view x : items) // NOLINT
             if(arg == x)
@@ -146,10 +601,9 @@ struct One: public Base<One> {
     }
 
     std::vector<std::string_view> items;
+    std::vector<Slot> slots;
 };
 
-using ParamType = std::variant<Param, One>;
-
 struct Info {
     static constexpr char PATH_SEPARATOR =
 #if defined(_WIN32)
@@ -172,85 +626,6 @@ inline Info info;
 
 } // namespace impl
 
-struct Arg {
-    template<typename>
-    static constexpr bool always_false_v = false;
-
-    Arg() = default;
-
-    template<typename T>
-    explicit Arg(T t): v{t} {}
-
-    [[nodiscard]] bool is_null() const {
-        return std::holds_alternative<std::monostate>(v);
-    }
-
-    [[nodiscard]] bool is_bool() const {
-        return std::holds_alternative<bool>(v);
-    }
-
-    [[nodiscard]] bool is_int() const { return std::holds_alternative<int>(v); }
-
-    [[nodiscard]] bool is_string() const {
-        return std::holds_alternative<std::string_view>(v);
-    }
-
-    [[nodiscard]] bool to_bool() const { return std::get<bool>(v); }
-
-    [[nodiscard]] int to_int() const { return std::get<int>(v); }
-
-    [[nodiscard]] std::string_view to_stringview() const {
-        return std::get<std::string_view>(v);
-    }
-
-    [[nodiscard]] std::string to_string() const {
-        return std::string{std::get<std::string_view>(v)};
-    }
-
-    template<typename T>
-    bool operator==(T rhs) const {
-        using U = std::decay_t<T>;
-
-        if constexpr(std::is_null_pointer_v<T>)
-            return this->is_null();
-        if constexpr(std::is_convertible_v<U, std::string_view>)
-            return this->is_string() && this->to_stringview() == rhs;
-        else if constexpr(std::is_same_v<U, bool>)
-            return this->is_bool() && this->to_bool() == rhs;
-        else if constexpr(std::is_convertible_v<U, int>)
-            return this->is_int() && this->to_int() == rhs;
-        else
-            static_assert(Arg::always_false_v<U>);
-    }
-
-    template<typename T>
-    bool operator!=(T rhs) const {
-        return !this->operator==(rhs);
-    }
-
-    [[nodiscard]] std::string dump() const {
-        return std::visit(
-            [](auto& x) -> std::string {
-                using T = std::decay_t<decltype(x)>;
-
-                if constexpr(std::is_same_v<T, bool>)
-                    return x ? "true" : "false";
-                else if constexpr(std::is_same_v<T, int>)
-                    return std::to_string(x);
-                else if constexpr(std::is_same_v<T, std::string_view>)
-                    return "\"" + std::string{x} + "\"";
-                else if constexpr(std::is_same_v<T, std::monostate>)
-                    return "null";
-                else
-                    static_assert(Arg::always_false_v<T>);
-            },
-            v);
-    }
-
-    explicit operator bool() const { return !this->is_null(); }
-
-    std::variant<std::monostate, bool, int, std::string_view> v;
-};
 
 struct Options {
     Options(std::initializer_list<impl::Opt> opts) {
@@ -263,6 +638,8 @@ struct Options {
     static bool empty() { return Options::items.empty(); }
 
     static void complete() {
+        impl::layout.dirty = true;
+
         Options::items.insert(Options::items.begin(),
                               impl::Opt{"v", "version", "Show version"});
 
@@ -353,11 +730,21 @@ inline std::unordered_set<std::string_view> Options::valid;
 inline int Options::maxshortlength;
 inline int Options::maxlength;
 
-using Args = std::unordered_map<std::string_view, Arg>;
 using Entry = std::function<void(const Args&)>;
 
 namespace impl {
 
+/*
+ * A command entry held by pointer: copies of a Cmd share it, and programs
+ * that never set one (see cl::NoEntry) do not instantiate std::function.
+ */
+struct EntryRef {
+    void operator()(const Args& args) const { (*fn)(args); }
+    explicit operator bool() const { return fn != nullptr; }
+
+    std::shared_ptr<const Entry> fn;
+};
+
 struct ParamPrinter {
     static std::string dump(const Param& p) {
         if(p.option) {
@@ -383,7 +770,7 @@ struct ParamPrinter {
         return "(" + res + ")";
     }
 
-    static std::string dump(ParamType& p) {
+    static std::string dump(const ParamType& p) {
         return std::visit([](auto&& x) { return ParamPrinter::dump(x); }, p);
     }
 
@@ -430,8 +817,13 @@ struct Cmd {
         return *this;
     }
 
+    Cmd& operator,(const RestParam& rhs) {
+        rest = rhs.validator;
+        return *this;
+    }
+
     Cmd& operator>>(Entry&& rhs) {
-        entry = std::move(rhs);
+        entry.fn = std::make_shared<const Entry>(std::move(rhs));
         return *this;
     }
 
@@ -439,7 +831,7 @@ struct Cmd {
     void check_required(const T& p) {
         if(p.required) {
             if(!this->is_prev_required()) {
-                impl::error_and_exit(
+                impl::print_and_exit(
                     "Positional '", impl::ParamPrinter::dump(p),
                     "' cannot be required because '",
                     impl::ParamPrinter::dump(args.back()),
@@ -459,14 +851,86 @@ struct Cmd {
     explicit Cmd(std::string_view n): name{n} {}
     explicit Cmd(std::string_view n, bool a): name{n}, any{a} {}
 
+    operator Handle() const { return Handle{slot}; } // NOLINT
+
     std::string_view name;
+    Slot slot{impl::make_slot()};
     bool any{false};
     std::vector<ParamType> args{};
     std::vector<Param> options{};
-    Entry entry{nullptr};
+    EntryRef entry{};
+    Validator rest{nullptr};
     size_t mincount{0};
 };
 
+// True if every option required by 'a' is allowed by 'b'
+inline bool allows_required(const Cmd& a, const Cmd& b) {
+    for(const Param& p : a.options) {
+        if(!p.required)
+            continue;
+
+        auto o = Options::get_option(p.val);
+
+        bool allowed = std::any_of(
+            b.options.begin(), b.options.end(), [&](const Param& q) {
+                auto other = Options::get_option(q.val);
+                return o && other ? o->name == other->name : p.val == q.val;
+            });
+
+        if(!allowed)
+            return false;
+    }
+
+    return true;
+}
+
+inline bool intersects(const ParamType& a, const ParamType& b) {
+    const auto* oa = std::get_if<One>(&a);
+    const auto* ob = std::get_if<One>(&b);
+
+    if(!oa || !ob)
+        return true;
+
+    return std::any_of(oa->items.begin(), oa->items.end(),
+                       [ob](std::string_view x) { return ob->contains(x); });
+}
+
+/*
+ * True if a command line can be accepted by both commands: their arities
+ * are compatible, their choices intersect where one of them requires a
+ * value (see accepts()) and each allows the options the other requires.
+ */
+inline bool overlaps(const Cmd& a, const Cmd& b) {
+    size_t n = std::max(a.mincount, b.mincount);
+
+    if(n > a.args.size() || n > b.args.size())
+        return false;
+
+    for(size_t i = 0; i < n; i++) {
+        if(!impl::intersects(a.args[i], b.args[i]))
+            return false;
+    }
+
+    return impl::allows_required(a, b) && impl::allows_required(b, a);
+}
+
+// A constraint between options, see cl::Rules
+struct Rule {
+    Rule(RuleKind k, std::vector<std::string_view> n)
+        : kind{k}, names{std::move(n)} {
+        if(names.size() < (kind == RuleKind::DEPENDS ? 2 : 1))
+            impl::print_and_exit("Rule has too few options");
+
+        for(std::string_view name : names) {
+            if(!Options::valid.count(name))
+                impl::print_and_exit("Unknown option '", name, "' in rule");
+        }
+    }
+
+    RuleKind kind;
+    std::vector<std::string_view> names; // Option names or short names
+};
+
 } // namespace impl
 
 struct Usage {
@@ -475,9 +939,22 @@ struct Usage {
             if(Usage::commands.count(c.name))
                 impl::print_and_exit("Duplicate command '", c.name, "'");
 
+            // Any-commands are tried together, the first declared one wins
+            for(const impl::Cmd& other : Usage::items) {
+                if(!cl::reject_ambiguous || !c.any || !other.any)
+                    continue;
+
+                if(impl::overlaps(c, other)) {
+                    impl::print_and_exit("Ambiguous commands '", other.name,
+                                         "' and '", c.name, "'");
+                }
+            }
+
             Usage::items.push_back(c);
             Usage::commands.insert(c.name);
         }
+
+        impl::layout.dirty = true;
     }
 
     static std::vector<impl::Cmd> items;
@@ -487,26 +964,123 @@ struct Usage {
 inline std::vector<impl::Cmd> Usage::items;
 inline std::unordered_set<std::string_view> Usage::commands;
 
-namespace impl {
-inline void version() {
-    if(!info.name.empty()) {
-        std::fputs(info.name.data(), stdout);
-        std::fputs(" ", stdout);
+/*
+ * Constraints between options, compiled into option id masks when the
+ * grammar is finalized. A rule applies to the commands allowing one of
+ * its options (the first one for cl::depends()).
+ */
+struct Rules {
+    Rules(std::initializer_list<impl::Rule> rules) {
+        Rules::items.insert(Rules::items.end(), rules);
+        impl::layout.dirty = true;
     }
 
-    if(!info.version.empty())
-        std::fputs(info.version.data(), stdout);
+    static std::vector<impl::Rule> items;
+};
 
-    if(!info.description.empty()) {
-        std::fputs("\n", stdout);
-        std::fputs(info.description.data(), stdout);
+inline std::vector<impl::Rule> Rules::items;
+
+#if defined(CL_DEFINE_API)
+CL_API std::string Error::message() const {
+    switch(code) {
+        case ErrorCode::NONE: return {};
+        case ErrorCode::HELP: return "Help requested";
+        case ErrorCode::VERSION: return "Version requested";
+
+        case ErrorCode::UNKNOWN_COMMAND:
+            return impl::concat("Unknown command '", token, "'");
+
+        case ErrorCode::INVALID_OPTION:
+            return impl::concat("Invalid option '", token, "'");
+
+        case ErrorCode::INVALID_OPTION_FORMAT:
+            return impl::concat("Invalid option format '", token, "'");
+
+        case ErrorCode::INVALID_SHORT_OPTION_FORMAT:
+            return "Invalid short option format";
+
+        case ErrorCode::INVALID_ARGUMENT:
+            return impl::concat("Invalid argument '", token, "'");
+
+        case ErrorCode::MISSING_ARGUMENT:
+            return impl::concat("Missing required argument '",
+                                impl::ParamPrinter::dump(*param), "'");
+
+        case ErrorCode::MISSING_OPTION:
+            return impl::concat("Missing required option '", token, "'");
+
+        case ErrorCode::TOO_MANY_ARGUMENTS:
+            return impl::concat("Too many arguments '", token, "'");
+
+        case ErrorCode::INVALID_QUOTING:
+            return impl::concat("Unterminated quote or escape in argument ",
+                                std::to_string(index));
+
+        case ErrorCode::INVALID_VALUE:
+            if(reason.empty())
+                return impl::concat("Invalid value '", token, "'");
+
+            return impl::concat("Invalid value '", token, "': ", reason);
+
+        case ErrorCode::UNEXPECTED_OPTION:
+            return impl::concat("Option '", token,
+                                "' is not allowed for this command");
+
+        case ErrorCode::AMBIGUOUS_COMMAND:
+            return impl::concat("Ambiguous command '", token, "'");
+
+        case ErrorCode::AMBIGUOUS_OPTION:
+            return impl::concat("Ambiguous option '", token, "'");
+
+        case ErrorCode::CONFLICTING_OPTIONS:
+            return impl::concat("Option '", token, "' conflicts with '",
+                                other, "'");
+
+        case ErrorCode::MISSING_DEPENDENCY:
+            return impl::concat("Option '", token, "' requires '--", other,
+                                "'");
+
+        case ErrorCode::MISSING_OPTION_GROUP: {
+            std::string res = "One of ";
+
+            for(size_t i = 0; i < rule->names.size(); i++) {
+                res += i ? ", '--" : "'--";
+                res += Options::get_option(rule->names[i])->name;
+                res += "'";
+            }
+
+            return res + " is required";
+        }
+
+        default: break;
+    }
+
+    impl::abort();
+}
+#endif
+
+namespace impl {
+
+#if defined(CL_DEFINE_API)
+CL_API void version() {
+    if(!info.name.empty()) {
+        std::fputs(info.name.data(), stdout);
+        std::fputs(" ", stdout);
+    }
+
+    if(!info.version.empty())
+        std::fputs(info.version.data(), stdout);
+
+    if(!info.description.empty()) {
+        std::fputs("\n", stdout);
+        std::fputs(info.description.data(), stdout);
     }
 
     if(info.has_header())
         std::fputs("\n", stdout);
 }
 
-inline void help() {
+CL_API void help() {
     if(Options::empty())
         Options::complete();
 
@@ -579,6 +1153,7 @@ inline void help() {
         std::fputs("\n", stdout);
     }
 }
+#endif
 
 template<typename... Ts>
 [[noreturn]] inline void error_and_exit(Ts&&... args) {
@@ -602,226 +1177,2257 @@ template<typename... Ts>
     std::exit(1);
 }
 
-inline Args init_value() {
-    Args values;
+/*
+ * Levenshtein distance from a fixed pattern, computed with Myers'
+ * bit-parallel algorithm (as formulated by Hyyrö): one machine word holds
+ * a whole DP column, so each text character costs a few bit operations.
+ * Patterns longer than a word fall back to the classic DP.
+ */
+struct Levenshtein {
+    static constexpr size_t WORD_BITS = 64;
 
-    for(impl::Cmd& c : Usage::items) {
-        values.try_emplace(c.name, false);
+    explicit Levenshtein(std::string_view p): pattern{p} {
+        if(p.size() > WORD_BITS)
+            return;
 
-        for(ParamType& arg : c.args) {
-            std::visit(
-                [&](auto& x) {
-                    using T = std::decay_t<decltype(x)>;
-
-                    if constexpr(std::is_same_v<T, Param>) {
-                        if(!x.option)
-                            values.try_emplace(x.val, Arg{});
-                    }
-                    else if constexpr(std::is_same_v<T, One>) {
-                        for(std::string_view item : x.items)
-                            values.try_emplace(item, false);
-                    }
-                    else
-                        static_assert(Arg::always_false_v<T>);
-                },
-                arg);
-        }
-    }
-
-    for(impl::Opt& o : Options::items) {
-        if(o.flag)
-            values.try_emplace(o.name, Arg{false});
-        else
-            values.try_emplace(o.name, Arg{});
+        for(size_t i = 0; i < p.size(); i++)
+            peq[static_cast<unsigned char>(p[i])] |= uint64_t{1} << i;
     }
 
-    return values;
+    [[nodiscard]] size_t distance(std::string_view text) const {
+        size_t m = pattern.size();
+
+        if(!m)
+            return text.size();
+        if(m > WORD_BITS)
+            return this->dp(text);
+
+        uint64_t pv = ~uint64_t{0}, mv = 0;
+        uint64_t last = uint64_t{1} << (m - 1);
+        size_t score = m;
+
+        for(char ch : text) {
+            uint64_t eq = peq[static_cast<unsigned char>(ch)];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+
+            if(ph & last)
+                ++score;
+            else if(mh & last)
+                --score;
+
+            ph = (ph << 1) | 1; // The first row grows by one per character
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+
+        return score;
+    }
+
+    std::string_view pattern;
+    std::array<uint64_t, 256> peq{};
+
+private:
+    [[nodiscard]] size_t dp(std::string_view text) const {
+        std::vector<size_t> row(pattern.size() + 1);
+
+        for(size_t i = 0; i < row.size(); i++)
+            row[i] = i;
+
+        for(size_t j = 1; j <= text.size(); j++) {
+            size_t diag = row[0];
+            row[0] = j;
+
+            for(size_t i = 1; i < row.size(); i++) {
+                size_t up = row[i];
+                size_t cost = pattern[i - 1] != text[j - 1];
+                row[i] = std::min({row[i] + 1, row[i - 1] + 1, diag + cost});
+                diag = up;
+            }
+        }
+
+        return row.back();
+    }
+};
+
+// First name of 'v' not less than 'prefix'
+inline SortedNames::const_iterator lower_name(const SortedNames& v,
+                                              std::string_view prefix) {
+    return std::lower_bound(
+        v.begin(), v.end(), prefix,
+        [](const auto& x, std::string_view p) { return x.first < p; });
 }
 
-} // namespace impl
+// Calls 'fn(name, index)' for every name of 'v' starting with 'prefix'
+template<typename Function>
+void for_prefix(const SortedNames& v, std::string_view prefix,
+                Function&& fn) {
+    for(auto it = impl::lower_name(v, prefix); it != v.end(); ++it) {
+        if(it->first.substr(0, prefix.size()) != prefix)
+            break;
 
-template<typename... Ts>
-impl::One one(Ts&&... args) {
-    return impl::One{std::forward<Ts>(args)...};
+        fn(it->first, it->second);
+    }
 }
 
-template<typename... Ts>
-impl::Cmd cmd(impl::Cmd&& c, Ts&&... args) {
-    return (c, ..., args);
+constexpr uint32_t AMBIGUOUS = Handle::NO_SLOT - 1;
+
+// Index of the only name starting with 'prefix', AMBIGUOUS if there are
+// more, NO_SLOT if there are none
+inline uint32_t find_prefix(const SortedNames& v, std::string_view prefix) {
+    auto it = impl::lower_name(v, prefix);
+
+    auto matches = [&](SortedNames::const_iterator i) {
+        return i != v.end() && i->first.substr(0, prefix.size()) == prefix;
+    };
+
+    if(!matches(it))
+        return Handle::NO_SLOT;
+
+    return matches(std::next(it)) ? AMBIGUOUS : it->second;
 }
 
-template<typename... Ts>
-impl::Cmd cmd(std::string_view c, Ts&&... args) {
-    return (impl::Cmd{c}, ..., args);
+// '--help' and '--version', accepted after any command
+inline bool is_builtin(uint32_t id) {
+    return std::find(layout.builtins.begin(), layout.builtins.end(), id) !=
+           layout.builtins.end();
 }
 
-inline impl::Opt opt(std::string_view s, impl::OptParam l,
-                     std::string_view d = {}) {
-    return impl::Opt{s, l, d};
+// Same as above, only for the names whose index passes 'accept'
+template<typename Predicate>
+uint32_t find_prefix(const SortedNames& v, std::string_view prefix,
+                     Predicate&& accept) {
+    uint32_t res = Handle::NO_SLOT;
+
+    for(auto it = impl::lower_name(v, prefix); it != v.end(); ++it) {
+        if(it->first.substr(0, prefix.size()) != prefix)
+            break;
+
+        if(!accept(it->second))
+            continue;
+        if(res != Handle::NO_SLOT)
+            return AMBIGUOUS;
+
+        res = it->second;
+    }
+
+    return res;
 }
 
-inline impl::Opt opt(impl::OptParam l, std::string_view d = {}) {
-    return impl::Opt{{}, l, d};
+/*
+ * Calls 'fn(name)' for every name close enough to 'word', at most 'k'
+ * times, nearest first (ties in candidate order). 'candidates(add)'
+ * calls 'add' for every candidate name. Names that cannot be closer
+ * than the current worst pick are skipped by their length alone.
+ */
+template<typename Candidates, typename Function>
+void nearest(std::string_view word, size_t k, Candidates&& candidates,
+             Function&& fn) {
+    if(!k)
+        return;
+
+    Levenshtein lev{word};
+    size_t maxdist = std::max<size_t>(2, word.size() / 3);
+    std::vector<std::pair<size_t, std::string_view>> best;
+
+    candidates([&](std::string_view name) {
+        size_t limit = best.size() < k ? maxdist : best.back().first - 1;
+        size_t delta = name.size() > word.size() ? name.size() - word.size()
+                                                 : word.size() - name.size();
+
+        if(delta > limit || name == word)
+            return;
+
+        size_t d = lev.distance(name);
+
+        if(d > limit)
+            return;
+
+        auto it = std::upper_bound(
+            best.begin(), best.end(), d,
+            [](size_t x, const auto& b) { return x < b.first; });
+
+        for(auto i = best.begin(); i != it; i++) {
+            if(i->second == name)
+                return;
+        }
+
+        best.emplace(it, d, name);
+
+        if(best.size() > k)
+            best.pop_back();
+    });
+
+    for(const auto& [d, name] : best)
+        fn(name);
 }
 
-inline void set_name(std::string_view n) {
-    impl::info.name = n.empty() ? impl::PROGRAM_DEFAULT : n;
+} // namespace impl
+
+/*
+ * "Did you mean" candidates for an unknown command, an invalid option
+ * or an invalid choice, nearest first.
+ */
+inline std::vector<std::string> suggest(const Error& e, size_t k = 3) {
+    std::vector<std::string> res;
+    auto add = [&res](std::string_view n) { res.emplace_back(n); };
+
+    auto commands = [](auto&& fn) {
+        for(const impl::Cmd& c : Usage::items) {
+            if(!c.any)
+                fn(c.name);
+        }
+    };
+
+    // Only names the parser matches, families and 1 character names aside
+    auto options = [](auto&& fn) {
+        for(const auto& [n, i] : impl::layout.longnames)
+            fn(n);
+
+        for(std::string_view n : impl::layout.shortnames)
+            fn(n);
+    };
+
+    // The choices of the rejected positional, if known
+    const auto* rejected = e.param ? std::get_if<impl::One>(e.param) : nullptr;
+
+    auto choices = [rejected](auto&& fn) {
+        if(rejected) {
+            for(std::string_view item : rejected->items)
+                fn(item);
+            return;
+        }
+
+        for(const impl::Cmd& c : Usage::items) {
+            for(const impl::ParamType& arg : c.args) {
+                if(const auto* one = std::get_if<impl::One>(&arg)) {
+                    for(std::string_view item : one->items)
+                        fn(item);
+                }
+            }
+        }
+    };
+
+    // Names are unique among long and short ones
+    auto addoption = [&res](std::string_view n) {
+        bool isshort = impl::layout.shortindex.find(n) != Handle::NO_SLOT;
+        res.push_back((isshort ? "-" : "--") + std::string{n});
+    };
+
+    switch(e.code) {
+        case ErrorCode::UNKNOWN_COMMAND:
+            impl::nearest(e.token, k, commands, add);
+            break;
+
+        case ErrorCode::INVALID_OPTION:
+            impl::nearest(Options::parse(e.token).first, k, options,
+                          addoption);
+            break;
+
+        case ErrorCode::INVALID_ARGUMENT:
+            impl::nearest(e.token, k, choices, add);
+            break;
+
+        case ErrorCode::AMBIGUOUS_COMMAND:
+        case ErrorCode::AMBIGUOUS_OPTION: {
+            bool command = e.code == ErrorCode::AMBIGUOUS_COMMAND;
+            std::string_view prefix =
+                command ? e.token : Options::parse(e.token).first;
+
+            impl::for_prefix(command ? impl::layout.cmdnames
+                                     : impl::layout.longnames,
+                             prefix, [&](std::string_view n, uint32_t id) {
+                                 if(!command && e.allowed &&
+                                    !e.allowed->test(id) &&
+                                    !impl::is_builtin(id))
+                                     return;
+
+                                 if(res.size() < k)
+                                     res.push_back((command ? "" : "--") +
+                                                   std::string{n});
+                             });
+            break;
+        }
+
+        default: break;
+    }
+
+    return res;
 }
 
-inline void set_version(std::string_view v) { impl::info.version = v; }
-inline void set_description(std::string_view v) { impl::info.description = v; }
-inline void set_program(std::string_view n) { impl::info.program = n; }
+namespace impl {
 
-inline void help() { impl::help(); }
+// The error message followed by the suggestions, if any
+inline std::string describe(const Error& e) {
+    std::string msg = e.message();
+    std::vector<std::string> names = cl::suggest(e);
 
-inline Args parse(int argc, char** argv) {
-    if(argc <= 1) {
-        if(!Usage::items.empty())
-            impl::help_and_exit();
-        return {};
+    for(size_t i = 0; i < names.size(); i++) {
+        msg += i ? "', '" : " (did you mean '";
+        msg += names[i];
     }
 
-    if(Options::empty())
-        Options::complete();
+    if(!names.empty())
+        msg += "'?)";
 
-    std::string_view c = argv[1];
+    return msg;
+}
 
-    if(argc == 2) {
-        if(c == "-h" || c == "--help")
-            impl::help_and_exit();
-        else if(c == "-v" || c == "--version")
-            impl::version_and_exit();
-    }
-
-    std::unordered_map<std::string_view, std::string_view> mopts;
-    std::vector<std::string_view> margs;
-
-    for(int i = 2; i < argc;) {
-        std::string_view arg{argv[i]};
-
-        if(arg.front() == '-') {
-            auto [name, val] = Options::parse(arg);
-            auto opt = Options::get_option(name);
-
-            if(opt) {
-                bool isshort = Options::is_short(arg);
-
-                if(!opt->flag) {
-                    if(isshort) {
-                        if(++i >= argc)
-                            impl::error_and_exit("Invalid short option format");
-                        arg = argv[i];
-                    }
-                    else {
-                        if(val.empty())
-                            impl::error_and_exit("Invalid option format '", arg,
-                                                 "'");
-                        arg = val;
-                    }
-                }
+[[noreturn]] inline void fail(const Error& e) {
+    switch(e.code) {
+        case ErrorCode::HELP:
+        case ErrorCode::TOO_MANY_ARGUMENTS: impl::help_and_exit();
+        case ErrorCode::VERSION: impl::version_and_exit();
+        case ErrorCode::UNKNOWN_COMMAND:
+            impl::print_and_exit(impl::describe(e));
+        case ErrorCode::NONE: impl::abort();
+        default: break;
+    }
+
+    impl::error_and_exit(impl::describe(e));
+}
+
+// Usage::items index of a command name
+inline uint32_t find_command(std::string_view name) {
+    uint32_t id = layout.index.find(name);
+    return id != Handle::NO_SLOT ? layout.commands[id] : id;
+}
+
+// Options::items index of an option name or short name
+inline uint32_t find_option(std::string_view name) {
+    uint32_t id = layout.index.find(name);
+
+    if(id != Handle::NO_SLOT && layout.options[id] != Handle::NO_SLOT)
+        return layout.options[id];
+
+    id = layout.shortindex.find(name);
+    return id != Handle::NO_SLOT ? layout.shortoptions[id] : id;
+}
+
+inline void build_layout() {
+    layout.names.clear();
+    layout.defaults.clear();
+    layout.commands.clear();
+    layout.options.clear();
+    layout.fingerprint = HASH_OFFSET;
+
+    std::unordered_map<std::string_view, uint32_t> ids;
 
-                ++i;
-                mopts[opt->name] = arg;
+    auto add = [&](std::string_view name, const Arg& def) -> uint32_t {
+        auto [it, ok] =
+            ids.try_emplace(name, static_cast<uint32_t>(layout.names.size()));
+
+        if(ok) {
+            layout.names.push_back(name);
+            layout.defaults.push_back(def);
+            layout.commands.push_back(Handle::NO_SLOT);
+            layout.options.push_back(Handle::NO_SLOT);
+
+            // Names are NUL separated, so that "ab","c" differs from "a","bc"
+            layout.fingerprint = impl::hash(name, layout.fingerprint);
+            layout.fingerprint = impl::hash({"\0", 1}, layout.fingerprint);
+        }
+
+        return it->second;
+    };
+
+    for(size_t i = 0; i < Usage::items.size(); i++) {
+        impl::Cmd& c = Usage::items[i];
+        *c.slot = add(c.name, Arg{false});
+        layout.commands[*c.slot] = static_cast<uint32_t>(i);
+
+        for(ParamType& arg : c.args) {
+            if(auto* p = std::get_if<Param>(&arg)) {
+                if(!p->option)
+                    *p->slot = add(p->val, Arg{});
             }
-            else
-                impl::error_and_exit("Invalid option '", arg, "'");
+            else {
+                One& one = std::get<One>(arg);
 
-            continue;
+                for(size_t k = 0; k < one.items.size(); k++)
+                    *one.slots[k] = add(one.items[k], Arg{false});
+            }
         }
+    }
 
-        margs.push_back(arg);
-        i++;
+    layout.shortnames.clear();
+    layout.shortoptions.clear();
+
+    for(size_t i = 0; i < Options::items.size(); i++) {
+        impl::Opt& o = Options::items[i];
+        *o.slot = add(o.name, o.flag ? Arg{false} : Arg{});
+
+        // See Options::get_option()
+        if(o.name.size() > 1)
+            layout.options[*o.slot] = static_cast<uint32_t>(i);
+
+        // A family prefix alone is not an option
+        if(o.shortname.size() > 1 && !o.family) {
+            layout.shortnames.push_back(o.shortname);
+            layout.shortoptions.push_back(static_cast<uint32_t>(i));
+        }
     }
 
-    // Keep an original copy for rollback
-    std::vector<std::string_view> basemargs = margs;
-    Args v = impl::init_value();
+    layout.lazydefaults.assign(layout.names.size(), nullptr);
+    layout.lazy.words.clear();
 
-    for(impl::Cmd& cmd : Usage::items) {
-        if(!cmd.any && cmd.name != c)
+    for(const impl::Opt& o : Options::items) {
+        if(!o.lazydefault)
             continue;
 
-        if(margs.size() > cmd.args.size())
-            impl::help_and_exit();
-
-        v[cmd.name] = Arg{c};
-
-        bool skip = false;
-
-        for(size_t i = margs.size(); !skip && i < cmd.args.size(); i++) {
-            std::visit(
-                [&](auto& x) {
-                    if(x.required) {
-                        if(cmd.any)
-                            skip = true;
-                        else
-                            impl::error_and_exit("Missing required argument '",
-                                                 impl::ParamPrinter::dump(x),
-                                                 "'");
-                    }
-                },
-                cmd.args[i]);
-
-            margs.emplace_back(); // Fill remaining slots
-        }
-
-        /*
-         * Maybe an any-type command with invalid arguments has been found,
-         * rollback changes and keep finding for a better-fit one.
-         */
-        if(skip) {
-            margs = basemargs;
-            v = impl::init_value();
+        if(layout.lazy.empty())
+            layout.lazy.reset(layout.names.size());
+
+        layout.lazydefaults[*o.slot] = &o.lazydefault;
+        layout.lazy.set(*o.slot);
+    }
+
+    layout.index.build(layout.names);
+    layout.shortindex.build(layout.shortnames);
+    layout.longnames.clear();
+    layout.cmdnames.clear();
+
+    layout.families.clear();
+    layout.flagwords = 0;
+
+    for(size_t i = 0; i < Options::items.size(); i++) {
+        const impl::Opt& o = Options::items[i];
+
+        if(o.name.size() > 1 && !o.family)
+            layout.longnames.emplace_back(o.name, static_cast<uint32_t>(i));
+
+        if(!o.family)
             continue;
+
+        FamilyTable& f = layout.families.emplace_back();
+        f.prefix = o.shortname;
+        f.option = static_cast<uint32_t>(i);
+        f.slot = *o.slot;
+        f.offset = layout.flagwords;
+        f.words = (o.family->size() + 63) / 64;
+        f.open = o.family->empty();
+        f.index.build(*o.family);
+        layout.flagwords += 2 * f.words;
+
+        for(std::string_view n : *o.family) {
+            layout.fingerprint = impl::hash(n, layout.fingerprint);
+            layout.fingerprint = impl::hash({"\0", 1}, layout.fingerprint);
+        }
+    }
+
+    // Longest prefixes first, in declaration order: families are few
+    for(size_t i = 1; i < layout.families.size(); i++) {
+        for(size_t k = i; k > 0 && layout.families[k - 1].prefix.size() <
+                                       layout.families[k].prefix.size();
+            k--)
+            std::swap(layout.families[k - 1], layout.families[k]);
+    }
+
+    for(size_t i = 0; i < Usage::items.size(); i++) {
+        if(!Usage::items[i].any) {
+            layout.cmdnames.emplace_back(Usage::items[i].name,
+                                         static_cast<uint32_t>(i));
+        }
+    }
+
+    std::sort(layout.longnames.begin(), layout.longnames.end());
+    std::sort(layout.cmdnames.begin(), layout.cmdnames.end());
+    layout.rules.clear();
+
+    for(const Rule& r : Rules::items) {
+        Constraint& c = layout.rules.emplace_back();
+        c.kind = r.kind;
+        c.option = Handle::NO_SLOT;
+        c.mask.reset(Options::items.size());
+        c.rule = &r;
+
+        auto kind = static_cast<char>(r.kind);
+        layout.fingerprint = impl::hash({&kind, 1}, layout.fingerprint);
+
+        for(std::string_view n : r.names) {
+            uint32_t id = impl::find_option(n);
+            if(id == Handle::NO_SLOT)
+                impl::print_and_exit("Unknown option '", n, "' in rule");
+
+            if(r.kind == RuleKind::DEPENDS && c.option == Handle::NO_SLOT)
+                c.option = id;
+            else
+                c.mask.set(id);
+
+            layout.fingerprint = impl::hash(n, layout.fingerprint);
+            layout.fingerprint = impl::hash({"\0", 1}, layout.fingerprint);
+        }
+    }
+
+    layout.signatures.clear();
+    layout.builtins.clear();
+    layout.anys.clear();
+
+    // Accepted after any command, like in the past
+    for(std::string_view name : {"help", "version"}) {
+        uint32_t id = impl::find_option(name);
+
+        if(id != Handle::NO_SLOT)
+            layout.builtins.push_back(id);
+    }
+
+    for(size_t i = 0; i < Usage::items.size(); i++) {
+        impl::Cmd& c = Usage::items[i];
+        Signature& sig = layout.signatures.emplace_back();
+        sig.minargs = c.mincount;
+        sig.maxargs = c.args.size();
+        sig.allowed.reset(Options::items.size());
+        sig.required.reset(Options::items.size());
+
+        if(c.any)
+            layout.anys.push_back(static_cast<uint32_t>(i));
+
+        for(const ParamType& arg : c.args) {
+            Bitset& choices = sig.choices.emplace_back();
+            const auto* one = std::get_if<One>(&arg);
+
+            if(!one)
+                continue;
+
+            choices.reset(layout.names.size());
+
+            for(const Slot& slot : one->slots)
+                choices.set(*slot);
         }
 
-        for(size_t i = 0; i < cmd.args.size(); i++) {
-            std::visit(
-                [&](auto& x) {
-                    using T = std::decay_t<decltype(x)>;
-
-                    if constexpr(std::is_same_v<T, impl::One>) {
-                        if(!margs[i].empty() && !x.contains(margs[i])) {
-                            impl::error_and_exit("Invalid argument '", margs[i],
-                                                 "'");
-                        }
-
-                        for(std::string_view one : x.items)
-                            v[one] = Arg{margs[i] == one};
-                    }
-                    else if constexpr(std::is_same_v<T, impl::Param>) {
-                        if(!margs[i].empty())
-                            v[x.val] = Arg{margs[i]};
-                    }
-                    else
-                        static_assert(Arg::always_false_v<T>);
-                },
-                cmd.args[i]);
-        }
-
-        for(const impl::Param& arg : cmd.options) {
-            auto o = Options::get_option(arg.val);
-            if(!o)
+        for(impl::Param& p : c.options) {
+            uint32_t id = impl::find_option(p.val);
+            if(id == Handle::NO_SLOT)
                 impl::abort();
 
-            if(mopts.count(o->name)) {
-                if(o->flag)
-                    v[o->name] = Arg{true};
-                else
-                    v[o->name] = Arg{mopts[arg.val]};
+            *p.slot = *Options::items[id].slot;
+            sig.options.push_back(id);
+            sig.allowed.set(id);
+
+            if(layout.lazydefaults[*p.slot]) {
+                if(sig.lazy.empty())
+                    sig.lazy.reset(layout.names.size());
+
+                sig.lazy.set(*p.slot);
             }
-            else if(arg.required)
-                impl::error_and_exit("Missing required option '", o->name, "'");
+
+            if(p.required)
+                sig.required.set(id);
+            if(p.validator && !Options::items[id].flag)
+                sig.validated = true;
         }
 
-        if(cmd.entry)
-            cmd.entry(v);
-        return v;
+        for(const ParamType& arg : c.args) {
+            const auto* p = std::get_if<Param>(&arg);
+
+            if(p && p->validator)
+                sig.validated = true;
+        }
+
+        if(c.rest)
+            sig.validated = true;
+
+        for(size_t k = 0; k < layout.rules.size(); k++) {
+            const Constraint& r = layout.rules[k];
+
+            if(r.kind == RuleKind::DEPENDS ? sig.allowed.test(r.option)
+                                           : sig.allowed.count(r.mask) > 0)
+                sig.rules.push_back(static_cast<uint32_t>(k));
+        }
     }
 
-    impl::print_and_exit("Unknown command '", c, "'");
+    layout.dirty = false;
+}
+
+// Only the lazy defaults in 'lazy' are computed, see Signature::lazy
+inline Args init_value(const Bitset& lazy = layout.lazy) {
+    Args values;
+    values.values = layout.defaults;
+    values.flags.assign(layout.flagwords, 0);
+    values.pending = lazy.words;
+    return values;
+}
+
+} // namespace impl
+
+template<typename... Ts>
+impl::One one(Ts&&... args) {
+    return impl::One{std::forward<Ts>(args)...};
+}
+
+template<typename... Ts>
+impl::Cmd cmd(impl::Cmd&& c, Ts&&... args) {
+    return (c, ..., args);
+}
+
+template<typename... Ts>
+impl::Cmd cmd(std::string_view c, Ts&&... args) {
+    return (impl::Cmd{c}, ..., args);
+}
+
+inline impl::Opt opt(std::string_view s, impl::OptParam l,
+                     std::string_view d = {}) {
+    return impl::Opt{s, l, d};
+}
+
+inline impl::Opt opt(impl::OptParam l, std::string_view d = {}) {
+    return impl::Opt{{}, l, d};
+}
+
+/*
+ * A valued option whose default is computed by 'def' (eg. probing the
+ * system): it is only called if the option is absent and its value is
+ * read, then the value is kept in Args.
+ */
+inline impl::Opt opt(std::string_view s, impl::OptParam l, std::string_view d,
+                     DefaultValue def) {
+    if(l.flag)
+        impl::print_and_exit("Flag '", l.val, "' cannot have a default");
+
+    impl::Opt o{s, l, d};
+    o.lazydefault = std::move(def);
+    return o;
 }
 
+inline impl::Opt opt(impl::OptParam l, std::string_view d, DefaultValue def) {
+    return cl::opt({}, l, d, std::move(def));
+}
+
+// Checks each argument after '--' given in argv: cl::cmd("exec", cl::rest(f))
+inline impl::RestParam rest(Validator v) {
+    return impl::RestParam{std::move(v)};
+}
+
+/*
+ * A family of flags '-<prefix><name>' and '-<prefix>no-<name>' declared
+ * as one option 'key': 'names' is its closed set of names, if empty any
+ * name is accepted. Read them with Args::flag(key, name).
+ */
+inline impl::Opt family(std::string_view prefix, std::string_view key,
+                        std::vector<std::string_view> names,
+                        std::string_view d = {}) {
+    if(prefix.empty())
+        impl::print_and_exit("Option family '", key, "' has no prefix");
+
+    std::unordered_set<std::string_view> unique;
+
+    for(std::string_view n : names) {
+        if(n.empty() || !unique.insert(n).second) {
+            impl::print_and_exit("Invalid or duplicate name '", n,
+                                 "' in option family '", key, "'");
+        }
+    }
+
+    impl::Opt o{prefix, impl::OptParam{key, true}, d};
+    o.family = std::make_shared<const std::vector<std::string_view>>(
+        std::move(names));
+    return o;
+}
+
+template<typename... Ts>
+impl::Rule at_most_one(Ts&&... names) {
+    return impl::Rule{impl::RuleKind::AT_MOST_ONE, {names...}};
+}
+
+template<typename... Ts>
+impl::Rule exactly_one(Ts&&... names) {
+    return impl::Rule{impl::RuleKind::EXACTLY_ONE, {names...}};
+}
+
+template<typename... Ts>
+impl::Rule at_least_one(Ts&&... names) {
+    return impl::Rule{impl::RuleKind::AT_LEAST_ONE, {names...}};
+}
+
+// 'option' can only be given with all of 'names'
+template<typename... Ts>
+impl::Rule depends(std::string_view option, Ts&&... names) {
+    return impl::Rule{impl::RuleKind::DEPENDS, {option, names...}};
+}
+
+inline void set_name(std::string_view n) {
+    impl::info.name = n.empty() ? impl::PROGRAM_DEFAULT : n;
+}
+
+inline void set_version(std::string_view v) { impl::info.version = v; }
+inline void set_description(std::string_view v) { impl::info.description = v; }
+inline void set_program(std::string_view n) { impl::info.program = n; }
+
+#if defined(CL_DEFINE_API)
+CL_API void help() { impl::help(); }
+#endif
+
+namespace impl {
+
+constexpr std::string_view TERMINATOR = "--";
+
+// Tokens from argv, argv[0] (the program) is skipped
+struct ArgvTokens {
+    ArgvTokens(int c, char** v): argc{c}, argv{v} {}
+
+    bool next(Token& t) {
+        if(index >= argc)
+            return false;
+
+        t = Token{argv[index], index};
+        ++index;
+        return true;
+    }
+
+    // Tokens not read yet
+    [[nodiscard]] Rest rest() const {
+        return Rest{argv + index, argc - index, {}};
+    }
+
+    int argc;
+    char** argv;
+    int index{1};
+    Error error{};
+};
+
+/*
+ * POSIX shell-like tokenizer working in place on a caller owned buffer:
+ * whitespace separates tokens, single quotes are literal, double quotes
+ * allow \\, \", \$ and \` escapes, a backslash escapes any character outside
+ * quotes. Unescaping never grows a token, so it is done by compacting the
+ * buffer; plain tokens are returned as views without touching it.
+ */
+struct LineTokens {
+    LineTokens(char* b, char* e): p{b}, end{e} {}
+
+    static bool is_space(char ch) {
+        return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' ||
+               ch == '\v' || ch == '\f';
+    }
+
+    static bool is_special(char ch) {
+        return is_space(ch) || ch == '\'' || ch == '"' || ch == '\\';
+    }
+
+    bool next(Token& t) {
+        for(;;) {
+            while(p != end && is_space(*p))
+                ++p;
+
+            if(p == end)
+                return false;
+
+            char* start = p;
+
+            while(p != end && !is_special(*p))
+                ++p;
+
+            char* w = p;
+            bool quoted = false;
+
+            // The token is partly unescaped already, only its index is valid
+            if(p != end && !is_space(*p) && !this->unescape(w, quoted)) {
+                error = Error{ErrorCode::INVALID_QUOTING, index};
+                return false;
+            }
+
+            last = p;
+
+            if(p != end)
+                ++p; // Skip separator
+
+            // A lone line continuation is not a token
+            if(w == start && !quoted)
+                continue;
+
+            t = Token{{start, static_cast<size_t>(w - start)}, index};
+            ++index;
+            return true;
+        }
+    }
+
+    // The line not tokenized yet, as written
+    [[nodiscard]] Rest rest() const {
+        char* b = p;
+
+        while(b != end && is_space(*b))
+            ++b;
+
+        return Rest{nullptr, 0, {b, static_cast<size_t>(end - b)}};
+    }
+
+    char* p;
+    char* end;
+    char* last{nullptr}; // End of the last token, as written
+    int index{1};
+    Error error{};
+
+private:
+    bool unescape(char*& w, bool& quoted) {
+        char quote = 0;
+
+        for(; p != end; ++p) {
+            char ch = *p;
+
+            if(quote == '\'') {
+                if(ch == '\'')
+                    quote = 0;
+                else
+                    *w++ = ch;
+            }
+            else if(ch == '\\') {
+                if(p + 1 == end)
+                    return false;
+
+                char nx = p[1];
+
+                if(quote == '"' && nx != '"' && nx != '\\' && nx != '$' &&
+                   nx != '`' && nx != '\n') {
+                    *w++ = ch;
+                    continue;
+                }
+
+                ++p;
+                if(nx != '\n')
+                    *w++ = nx;
+            }
+            else if(quote == '"') {
+                if(ch == '"')
+                    quote = 0;
+                else
+                    *w++ = ch;
+            }
+            else if(ch == '\'' || ch == '"') {
+                quote = ch;
+                quoted = true;
+            }
+            else if(is_space(ch))
+                break;
+            else
+                *w++ = ch;
+        }
+
+        return !quote;
+    }
+};
+
+/*
+ * Per-parse working memory: it can be kept alive between parses
+ * so that storage is reused instead of being reallocated.
+ */
+struct Scratch {
+    struct Option {
+        uint32_t id;  // Options::items index
+        Token option; // As written
+        Token value;  // The option itself for flags
+    };
+
+    // A name of an option family
+    struct Name {
+        uint32_t family; // layout.families index
+        uint32_t bit;    // NO_SLOT if not in the table
+        Token name;
+        bool enabled;
+    };
+
+    void clear() {
+        options.clear();
+        given.reset(Options::items.size()); // Sized again once finalized
+        names.clear();
+        positionals.clear();
+        failures.clear();
+        name = Token{};
+        rest = Rest{};
+        restindex = 0;
+        allowed = nullptr;
+        command = nullptr;
+    }
+
+    void set_option(uint32_t id, const Token& option, const Token& val) {
+        if(given.test(id)) {
+            for(Option& o : options) {
+                if(o.id == id)
+                    o = Option{id, option, val};
+            }
+
+            return;
+        }
+
+        given.set(id);
+        options.push_back(Option{id, option, val});
+    }
+
+    [[nodiscard]] const Token* find_option(uint32_t id) const {
+        if(!given.test(id))
+            return nullptr;
+
+        for(const Option& o : options) {
+            if(o.id == id)
+                return &o.value;
+        }
+
+        return nullptr;
+    }
+
+    std::vector<Option> options;
+    Bitset given; // Option ids
+    std::vector<Name> names;
+    std::vector<Token> positionals;
+    std::vector<Error> failures;    // One per any-command, NONE while alive
+    Token name;                     // Command token
+    Rest rest;                      // After '--'
+    int restindex{0};               // Token index of rest[0]
+    const Bitset* allowed{nullptr}; // Options of the named command, if any
+    const Cmd* command{nullptr};    // Matched command
+};
+
+// Makes the grammar immutable, it can be shared between threads after this
+inline void finalize() {
+    if(Options::empty())
+        Options::complete();
+
+    if(layout.dirty)
+        impl::build_layout();
+}
+
+inline const Signature& signature(const Cmd& cmd) {
+    return layout.signatures[static_cast<size_t>(&cmd - Usage::items.data())];
+}
+
+// Empty values stand for omitted choices, a required one must be given
+inline bool accepts(const Bitset& choices, std::string_view val,
+                    bool required) {
+    if(choices.empty())
+        return true;
+
+    return val.empty() ? !required : choices.test(layout.index.find(val));
+}
+
+inline Error check_positionals(const Cmd& cmd, const Scratch& scratch,
+                               int argc) {
+    const Signature& sig = impl::signature(cmd);
+    const auto& margs = scratch.positionals;
+
+    if(margs.size() > sig.maxargs) {
+        const Token& t = margs[sig.maxargs];
+        return Error{ErrorCode::TOO_MANY_ARGUMENTS, t.index, t.val};
+    }
+
+    if(margs.size() < sig.minargs) {
+        return Error{ErrorCode::MISSING_ARGUMENT, argc, {},
+                     &cmd.args[margs.size()]};
+    }
+
+    for(size_t i = 0; i < margs.size(); i++) {
+        if(!impl::accepts(sig.choices[i], margs[i].val, i < sig.minargs)) {
+            return Error{ErrorCode::INVALID_ARGUMENT, margs[i].index,
+                         margs[i].val, &cmd.args[i]};
+        }
+    }
+
+    return Error{};
+}
+
+/*
+ * Counts the given options of a rule with an AND and a popcount per word,
+ * the offending tokens are only looked for once it is violated.
+ */
+inline Error check_rule(const Constraint& c, const Scratch& scratch,
+                        int argc) {
+    if(c.kind == RuleKind::DEPENDS) {
+        if(!scratch.given.test(c.option) || c.mask.subset_of(scratch.given))
+            return Error{};
+
+        for(const Scratch::Option& o : scratch.options) {
+            if(o.id != c.option)
+                continue;
+
+            for(std::string_view n : c.rule->names) {
+                uint32_t id = impl::find_option(n);
+
+                if(c.mask.test(id) && !scratch.given.test(id)) {
+                    return Error{ErrorCode::MISSING_DEPENDENCY,
+                                 o.option.index, o.option.val, nullptr,
+                                 c.rule, Options::items[id].name};
+                }
+            }
+        }
+
+        impl::abort();
+    }
+
+    size_t n = scratch.given.count(c.mask);
+
+    if(!n && c.kind != RuleKind::AT_MOST_ONE) {
+        return Error{ErrorCode::MISSING_OPTION_GROUP, argc, {}, nullptr,
+                     c.rule};
+    }
+
+    if(n < 2 || c.kind == RuleKind::AT_LEAST_ONE)
+        return Error{};
+
+    const Scratch::Option* first = nullptr;
+
+    for(const Scratch::Option& o : scratch.options) {
+        if(!c.mask.test(o.id))
+            continue;
+
+        if(first) {
+            return Error{ErrorCode::CONFLICTING_OPTIONS, o.option.index,
+                         o.option.val, nullptr, c.rule, first->option.val};
+        }
+
+        first = &o;
+    }
+
+    impl::abort();
+}
+
+// Options allowed by the named command 'name', null if not one
+inline const Bitset* named_options(std::string_view name) {
+    uint32_t named = impl::find_command(name);
+
+    if(named == Handle::NO_SLOT || Usage::items[named].any)
+        return nullptr;
+
+    return &layout.signatures[named].allowed;
+}
+
+inline Error check_options(const Cmd& cmd, const Scratch& scratch, int argc) {
+    const Signature& sig = impl::signature(cmd);
+
+    if(!scratch.given.subset_of(sig.allowed)) {
+        for(const Scratch::Option& o : scratch.options) {
+            if(!sig.allowed.test(o.id) && !impl::is_builtin(o.id)) {
+                return Error{ErrorCode::UNEXPECTED_OPTION, o.option.index,
+                             o.option.val};
+            }
+        }
+    }
+
+    if(!sig.required.subset_of(scratch.given)) {
+        for(uint32_t id : sig.options) {
+            if(sig.required.test(id) && !scratch.given.test(id)) {
+                return Error{ErrorCode::MISSING_OPTION, argc,
+                             Options::items[id].name};
+            }
+        }
+    }
+
+    for(uint32_t k : sig.rules) {
+        Error err = impl::check_rule(layout.rules[k], scratch, argc);
+
+        if(err.code != ErrorCode::NONE)
+            return err;
+    }
+
+    return Error{};
+}
+
+/*
+ * Runs all any-commands at once in a single pass over the positionals,
+ * like an NFA: a candidate dies on its first rejected token. The first
+ * declared survivor wins (Usage rejects overlapping ones); if none
+ * survives, the rejected value going further is reported: arity
+ * mismatches only mean that the command line is not for that candidate.
+ */
+inline Error match_any(Scratch& scratch, int argc) {
+    const auto& margs = scratch.positionals;
+    auto& failures = scratch.failures;
+    size_t alive = layout.anys.size();
+
+    failures.assign(alive, Error{});
+
+    for(size_t i = 0; alive && i < margs.size(); i++) {
+        const Token& t = margs[i];
+
+        for(size_t k = 0; k < layout.anys.size(); k++) {
+            if(failures[k].code != ErrorCode::NONE)
+                continue;
+
+            const Signature& sig = layout.signatures[layout.anys[k]];
+
+            if(i >= sig.maxargs)
+                failures[k] = {ErrorCode::TOO_MANY_ARGUMENTS, t.index, t.val};
+            else if(!impl::accepts(sig.choices[i], t.val, i < sig.minargs)) {
+                failures[k] = {ErrorCode::INVALID_ARGUMENT, t.index, t.val,
+                               &Usage::items[layout.anys[k]].args[i]};
+            }
+            else
+                continue;
+
+            --alive;
+        }
+    }
+
+    for(size_t k = 0; alive && k < layout.anys.size(); k++) {
+        if(failures[k].code != ErrorCode::NONE)
+            continue;
+
+        const Cmd& cmd = Usage::items[layout.anys[k]];
+
+        if(margs.size() < impl::signature(cmd).minargs) {
+            failures[k] = {ErrorCode::MISSING_ARGUMENT, argc, {},
+                           &cmd.args[margs.size()]};
+        }
+        else
+            failures[k] = impl::check_options(cmd, scratch, argc);
+
+        if(failures[k].code == ErrorCode::NONE) {
+            scratch.command = &cmd;
+            return Error{};
+        }
+    }
+
+    const Error* best = nullptr;
+    const Error* toomany = nullptr;
+
+    for(const Error& f : failures) {
+        if(f.code == ErrorCode::MISSING_ARGUMENT)
+            continue;
+
+        if(f.code == ErrorCode::TOO_MANY_ARGUMENTS) {
+            if(!toomany)
+                toomany = &f;
+        }
+        else if(!best || f.index > best->index)
+            best = &f;
+    }
+
+    if(best)
+        return *best;
+    if(toomany)
+        return *toomany;
+
+    return Error{ErrorCode::UNKNOWN_COMMAND, scratch.name.index,
+                 scratch.name.val};
+}
+
+// Adds '-<prefix>[no-]<name>' to 'scratch', the longest prefix wins
+inline Error match_family(const Token& t, Scratch& scratch) {
+    std::string_view arg = impl::strip_dash(t.val);
+
+    for(size_t i = 0; i < layout.families.size(); i++) {
+        const FamilyTable& f = layout.families[i];
+
+        if(arg.size() <= f.prefix.size() ||
+           arg.substr(0, f.prefix.size()) != f.prefix)
+            continue;
+
+        std::string_view name = arg.substr(f.prefix.size());
+        bool enabled = name.size() < 3 || name.substr(0, 3) != "no-";
+
+        if(!enabled)
+            name.remove_prefix(3);
+
+        // '-<prefix>no-' alone names nothing
+        if(name.empty())
+            break;
+
+        uint32_t bit = f.index.find(name);
+
+        if(bit == Handle::NO_SLOT && !f.open)
+            break;
+
+        scratch.set_option(f.option, t, t);
+        scratch.names.push_back(Scratch::Name{static_cast<uint32_t>(i), bit,
+                                              Token{name, t.index}, enabled});
+        return Error{};
+    }
+
+    return Error{ErrorCode::INVALID_OPTION, t.index, t.val};
+}
+
+/*
+ * Adds the token 't' to 'scratch' as a positional or as an option, the
+ * value of a short option is read from 'tokens'. Without VALUES options
+ * are flags only: valued options are rejected and '--name=value' is not
+ * split.
+ */
+template<bool VALUES = true, typename Tokens>
+Error match_token(Tokens& tokens, Token t, Scratch& scratch) {
+    std::string_view arg = t.val;
+
+    if(arg.empty() || arg.front() != '-') {
+        scratch.positionals.push_back(t);
+        return Error{};
+    }
+
+    std::string_view name = impl::strip_dash(arg), val;
+
+    if constexpr(VALUES)
+        std::tie(name, val) = Options::parse(arg);
+
+    uint32_t id = impl::find_option(name);
+
+    if(id == Handle::NO_SLOT && Options::is_short(arg) &&
+       !layout.families.empty())
+        return impl::match_family(t, scratch);
+    if(id != Handle::NO_SLOT && Options::items[id].family)
+        return Error{ErrorCode::INVALID_OPTION, t.index, arg};
+
+    // Only the options of the command, when it is known, can be abbreviated
+    if(id == Handle::NO_SLOT && cl::abbreviations && !Options::is_short(arg)) {
+        const Bitset* allowed = scratch.allowed;
+
+        id = impl::find_prefix(layout.longnames, name, [allowed](uint32_t i) {
+            return !allowed || allowed->test(i) || impl::is_builtin(i);
+        });
+    }
+
+    if(id == Handle::NO_SLOT)
+        return Error{ErrorCode::INVALID_OPTION, t.index, arg};
+    if(id == AMBIGUOUS) {
+        return Error{ErrorCode::AMBIGUOUS_OPTION, t.index, arg, nullptr,
+                     nullptr, {}, scratch.allowed};
+    }
+
+    Token option = t;
+
+    if(!Options::items[id].flag) {
+        if constexpr(!VALUES)
+            return Error{ErrorCode::INVALID_OPTION_FORMAT, t.index, arg};
+        else if(Options::is_short(arg)) {
+            Token v;
+
+            if(!tokens.next(v)) {
+                if(tokens.error.code != ErrorCode::NONE)
+                    return tokens.error;
+
+                return Error{ErrorCode::INVALID_SHORT_OPTION_FORMAT, t.index,
+                             arg};
+            }
+
+            t = v;
+            arg = v.val;
+        }
+        else {
+            if(val.empty())
+                return Error{ErrorCode::INVALID_OPTION_FORMAT, t.index, arg};
+
+            arg = val;
+        }
+    }
+
+    scratch.set_option(id, option, Token{arg, t.index});
+    return Error{};
+}
+
+// Matches the command 'first' once every token is in 'scratch'
+inline Error match_command(Scratch& scratch, const Token& first, int argc) {
+    std::string_view c = first.val;
+
+    // '--help' and '--version' are valid only when used alone
+    if(scratch.positionals.empty() && scratch.options.empty()) {
+        if(c == "-h" || c == "--help")
+            return Error{ErrorCode::HELP, first.index, c};
+        if(c == "-v" || c == "--version")
+            return Error{ErrorCode::VERSION, first.index, c};
+    }
+
+    auto match_named = [&](const Cmd& cmd) {
+        Error err = impl::check_positionals(cmd, scratch, argc);
+
+        if(err.code == ErrorCode::NONE)
+            err = impl::check_options(cmd, scratch, argc);
+        if(err.code == ErrorCode::NONE)
+            scratch.command = &cmd;
+
+        return err;
+    };
+
+    uint32_t named = impl::find_command(c);
+
+    if(named != Handle::NO_SLOT && !Usage::items[named].any)
+        return match_named(Usage::items[named]);
+
+    Error err = impl::match_any(scratch, argc);
+
+    // Abbreviations are tried last, a name accepted by an any-command wins
+    if(err.code == ErrorCode::NONE || !cl::abbreviations)
+        return err;
+
+    named = impl::find_prefix(layout.cmdnames, c);
+
+    if(named == AMBIGUOUS)
+        return Error{ErrorCode::AMBIGUOUS_COMMAND, first.index, c};
+    if(named == Handle::NO_SLOT)
+        return err;
+
+    scratch.name.val = Usage::items[named].name;
+    return match_named(Usage::items[named]);
+}
+
+/*
+ * Validates a command line, on success 'scratch' holds the matched command
+ * and its tokens (no command is matched if both the command line and the
+ * grammar are empty).
+ */
+template<bool VALUES = true, typename Tokens>
+Error match(Tokens& tokens, Scratch& scratch) {
+    Token first;
+    scratch.clear();
+
+    if(!tokens.next(first)) {
+        if(tokens.error.code != ErrorCode::NONE)
+            return tokens.error;
+        if(!Usage::items.empty())
+            return Error{ErrorCode::HELP};
+        return Error{};
+    }
+
+    impl::finalize();
+
+    scratch.given.reset(Options::items.size());
+    scratch.name = first;
+    scratch.allowed = impl::named_options(first.val);
+    Token t;
+
+    while(tokens.next(t)) {
+        // Tokens after '--' are passed through, they are not even read
+        if(t.val == TERMINATOR) {
+            scratch.rest = tokens.rest();
+            scratch.restindex = t.index + 1;
+            return impl::match_command(scratch, first, t.index);
+        }
+
+        Error err = impl::match_token<VALUES>(tokens, t, scratch);
+
+        if(err.code != ErrorCode::NONE)
+            return err;
+    }
+
+    if(tokens.error.code != ErrorCode::NONE)
+        return tokens.error;
+
+    return impl::match_command(scratch, first, tokens.index);
+}
+
+/*
+ * Calls 'set(slot, arg, index)' for every value given to the matched
+ * command, 'index' is the token the value comes from.
+ */
+template<bool VALUES = true, typename Function>
+void fill(const Scratch& scratch, Function&& set) {
+    const Cmd& cmd = *scratch.command;
+    const auto& margs = scratch.positionals;
+    set(*cmd.slot, Arg{scratch.name.val}, scratch.name.index);
+
+    for(size_t i = 0; i < margs.size(); i++) {
+        const Token& t = margs[i];
+
+        std::visit(
+            [&](auto& x) {
+                using T = std::decay_t<decltype(x)>;
+
+                if constexpr(std::is_same_v<T, One>) {
+                    uint32_t chosen = layout.index.find(t.val);
+
+                    for(const Slot& slot : x.slots)
+                        set(*slot, Arg{*slot == chosen}, t.index);
+                }
+                else if constexpr(std::is_same_v<T, Param>) {
+                    if(!t.val.empty())
+                        set(*x.slot, Arg{t.val}, t.index);
+                }
+                else
+                    static_assert(Arg::always_false_v<T>);
+            },
+            cmd.args[i]);
+    }
+
+    const Signature& sig = impl::signature(cmd);
+
+    for(size_t i = 0; i < cmd.options.size(); i++) {
+        const Token* t = scratch.find_option(sig.options[i]);
+
+        if(!t)
+            continue;
+
+        if(!VALUES || Options::items[sig.options[i]].flag)
+            set(*cmd.options[i].slot, Arg{true}, t->index);
+        else
+            set(*cmd.options[i].slot, Arg{t->val}, t->index);
+    }
+
+    for(uint32_t id : layout.builtins) {
+        const Token* t = scratch.find_option(id);
+
+        if(t && !sig.allowed.test(id))
+            set(*Options::items[id].slot, Arg{true}, t->index);
+    }
+}
+
+// Sets the option family names given in 'scratch'
+inline void fill_families(const Scratch& scratch, Args& args) {
+    for(const Scratch::Name& n : scratch.names) {
+        const FamilyTable& f = layout.families[n.family];
+
+        if(n.bit == Handle::NO_SLOT) {
+            args.others.push_back(FamilyName{f.slot, n.name.val, n.enabled});
+            continue;
+        }
+
+        size_t w = f.offset + (n.bit >> 6);
+        uint64_t mask = uint64_t{1} << (n.bit & 63);
+        args.flags[w] |= mask;
+
+        if(n.enabled)
+            args.flags[w + f.words] |= mask;
+        else
+            args.flags[w + f.words] &= ~mask;
+    }
+}
+
+/*
+ * Calls 'check(validator, token)' for every value of the matched command
+ * that has a Validator: positionals, valued options, then the arguments
+ * after '--' given in argv.
+ */
+template<bool VALUES = true, typename Function>
+void for_each_checked(const Scratch& scratch, Function&& check) {
+    const Cmd& cmd = *scratch.command;
+
+    if(!impl::signature(cmd).validated)
+        return;
+
+    const auto& margs = scratch.positionals;
+
+    for(size_t i = 0; i < margs.size(); i++) {
+        const auto* p = std::get_if<Param>(&cmd.args[i]);
+
+        if(p && p->validator && !margs[i].val.empty())
+            check(p->validator, margs[i]);
+    }
+
+    const Signature& sig = impl::signature(cmd);
+
+    for(size_t i = 0; VALUES && i < cmd.options.size(); i++) {
+        const Token* t = scratch.find_option(sig.options[i]);
+
+        if(t && cmd.options[i].validator &&
+           !Options::items[sig.options[i]].flag)
+            check(cmd.options[i].validator, *t);
+    }
+
+    if(!cmd.rest)
+        return;
+
+    for(size_t i = 0; i < scratch.rest.size(); i++) {
+        check(cmd.rest,
+              Token{scratch.rest[i], scratch.restindex + static_cast<int>(i)});
+    }
+}
+
+// Runs the validators in order, the first rejected value is the error
+template<bool VALUES = true>
+Error check_values(const Scratch& scratch) {
+    Error err;
+
+    impl::for_each_checked<VALUES>(
+        scratch, [&err](const Validator& v, const Token& t) {
+            if(err.code != ErrorCode::NONE)
+                return;
+
+            std::string reason = v(t.val);
+
+            if(!reason.empty()) {
+                err = Error{ErrorCode::INVALID_VALUE, t.index, t.val};
+                err.reason = std::move(reason);
+            }
+        });
+
+    return err;
+}
+
+// Args of the command matched in 'scratch'
+template<bool VALUES = true>
+Args to_args(const Scratch& scratch) {
+    if(!scratch.command)
+        return Args{};
+
+    Args v = impl::init_value(impl::signature(*scratch.command).lazy);
+
+    impl::fill<VALUES>(scratch, [&v](uint32_t slot, const Arg& arg, int) {
+        v.values[slot] = arg;
+    });
+
+    impl::fill_families(scratch, v);
+    v.rest = scratch.rest;
+    return v;
+}
+
+template<bool VALUES = true, typename Tokens>
+Result<Args> parse(Tokens& tokens, Scratch& scratch) {
+    Error err = impl::match<VALUES>(tokens, scratch);
+
+    if(err.code == ErrorCode::NONE && scratch.command)
+        err = impl::check_values<VALUES>(scratch);
+    if(err.code != ErrorCode::NONE)
+        return err;
+
+    return impl::to_args<VALUES>(scratch);
+}
+
+inline void dispatch(const Scratch& scratch, const Args& args) {
+    if(scratch.command && scratch.command->entry)
+        scratch.command->entry(args);
+}
+
+} // namespace impl
+
+#if defined(CL_DEFINE_API)
+CL_API Result<Args> try_parse(int argc, char** argv) {
+    impl::ArgvTokens tokens{argc, argv};
+    impl::Scratch scratch;
+    Result<Args> res = impl::parse(tokens, scratch);
+
+    if(res)
+        impl::dispatch(scratch, *res);
+
+    return res;
+}
+
+/*
+ * Parses a whole command line (without the program name), the buffer is
+ * unescaped in place: returned Args refer to it.
+ */
+CL_API Result<Args> try_parse(char* line, size_t size) {
+    impl::LineTokens tokens{line, line + size};
+    impl::Scratch scratch;
+    Result<Args> res = impl::parse(tokens, scratch);
+
+    if(res)
+        impl::dispatch(scratch, *res);
+
+    return res;
+}
+
+CL_API Result<Args> try_parse(std::string& line) {
+    return cl::try_parse(line.data(), line.size());
+}
+#endif
+
+namespace impl {
+
+constexpr size_t BATCH_BUFFER_SIZE = 64 * 1024;
+constexpr std::string_view BATCH_OPTION = "--cl-batch";
+constexpr std::string_view BATCH_KEEP_GOING_OPTION = "--cl-keep-going";
+
+// Returns true if the error is a builtin request (help, version)
+inline bool report(const Error& err, size_t lineno) {
+    switch(err.code) {
+        case ErrorCode::HELP: impl::help(); return true;
+        case ErrorCode::VERSION: impl::version(); return true;
+        default: break;
+    }
+
+    impl::print("ERROR: line ", std::to_string(lineno), ": ",
+                impl::describe(err));
+    return false;
+}
+
+/*
+ * Calls 'fn(begin, end, lineno)' for each non-blank, non-comment line of
+ * 'f', stops when 'fn' returns false. Records are mutable views into a
+ * reusable read buffer, valid only during the call.
+ */
+template<typename Function>
+void read_records(std::FILE* f, Function&& fn) {
+    std::vector<char> buffer(BATCH_BUFFER_SIZE);
+    size_t begin = 0, end = 0, lineno = 0;
+    bool eof = false;
+
+    while(!eof || begin < end) {
+        auto* nl = static_cast<char*>(
+            std::memchr(buffer.data() + begin, '\n', end - begin));
+
+        if(!nl && !eof) {
+            // Move the partial record at the beginning and read more
+            std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+
+            if(end == buffer.size())
+                buffer.resize(buffer.size() * 2);
+
+            size_t n =
+                std::fread(buffer.data() + end, 1, buffer.size() - end, f);
+
+            end += n;
+            eof = !n;
+            continue;
+        }
+
+        char* b = buffer.data() + begin;
+        char* e = nl ? nl : buffer.data() + end;
+        begin = nl ? static_cast<size_t>(nl - buffer.data()) + 1 : end;
+        ++lineno;
+
+        while(b != e && LineTokens::is_space(*b))
+            ++b;
+
+        if(b == e || *b == '#') // Skip blank lines and comments
+            continue;
+
+        if(!fn(b, e, lineno))
+            break;
+    }
+}
+
+} // namespace impl
+
+/*
+ * Parses one command line per record from 'f' and dispatches each
+ * command entry, returns the number of rejected records.
+ * Records are parsed in place in a reusable read buffer.
+ */
+#if defined(CL_DEFINE_API)
+CL_API size_t batch(std::FILE* f, bool keepgoing) {
+    impl::finalize();
+
+    impl::Scratch scratch;
+    size_t failed = 0;
+
+    impl::read_records(f, [&](char* b, char* e, size_t lineno) {
+        impl::LineTokens tokens{b, e};
+        Result<Args> res = impl::parse(tokens, scratch);
+
+        if(res) {
+            impl::dispatch(scratch, *res);
+            return true;
+        }
+
+        if(impl::report(res.error(), lineno))
+            return true;
+
+        ++failed;
+        return keepgoing;
+    });
+
+    return failed;
+}
+#endif
+
+namespace impl {
+
+// Handles '--cl-batch[=FILE] [--cl-keep-going]'
+[[noreturn]] inline void batch_and_exit(int argc, char** argv) {
+    std::string_view arg = argv[1];
+    std::string_view filename;
+    bool keepgoing = false;
+
+    if(arg.size() > BATCH_OPTION.size()) {
+        if(arg[BATCH_OPTION.size()] != '=')
+            impl::print_and_exit("Invalid option '", arg, "'");
+
+        filename = arg.substr(BATCH_OPTION.size() + 1);
+    }
+
+    for(int i = 2; i < argc; i++) {
+        if(argv[i] != BATCH_KEEP_GOING_OPTION)
+            impl::print_and_exit("Invalid batch option '", argv[i], "'");
+
+        keepgoing = true;
+    }
+
+    std::FILE* f = stdin;
+
+    if(!filename.empty()) {
+        f = std::fopen(filename.data(), "rb");
+
+        if(!f)
+            impl::print_and_exit("Cannot open '", filename, "'");
+    }
+
+    size_t failed = cl::batch(f, keepgoing);
+
+    if(f != stdin)
+        std::fclose(f);
+
+    std::exit(failed ? 2 : 0);
+}
+
+constexpr std::string_view COMPLETION_OPTION = "--cl-completion";
+
+// Names used unquoted in every supported shell, others are not completed
+inline bool is_shell_word(std::string_view v) {
+    return !v.empty() && std::all_of(v.begin(), v.end(), [](char ch) {
+        return std::isalnum(static_cast<unsigned char>(ch)) ||
+               (ch && std::strchr("_-+.,:@/=", ch));
+    });
+}
+
+/*
+ * The grammar as completion scripts see it, with the rules of
+ * cl::complete(): candidate lists are space separated, commands are
+ * referred to by their Usage::items index.
+ */
+struct ScriptGrammar {
+    struct Option {
+        std::vector<std::string_view> names; // Resolvable, without dashes
+        std::string words;                   // '-short --long[=]'
+        bool value;
+    };
+
+    struct Command {
+        std::string id;
+        std::string_view name; // Empty for any-commands
+        size_t maxargs;
+        std::string options;
+        std::vector<std::string> choices; // Per positional, empty if free
+    };
+
+    std::string names; // Named commands
+    std::vector<Option> options;
+    std::vector<Command> commands;
+};
+
+inline ScriptGrammar script_grammar() {
+    impl::finalize();
+
+    ScriptGrammar g;
+    std::vector<std::string> words(Options::items.size());
+
+    for(size_t i = 0; i < Options::items.size(); i++) {
+        const Opt& o = Options::items[i];
+        ScriptGrammar::Option opt{{}, {}, !o.flag};
+
+        if(o.family)
+            continue;
+
+        // Only names that find_option() resolves
+        if(o.shortname.size() > 1 && impl::is_shell_word(o.shortname)) {
+            opt.names.push_back(o.shortname);
+            words[i].append("-").append(o.shortname).append(" ");
+        }
+
+        if(o.name.size() > 1 && impl::is_shell_word(o.name)) {
+            opt.names.push_back(o.name);
+            words[i].append("--").append(o.name);
+            words[i].append(o.flag ? " " : "= ");
+        }
+
+        opt.words = words[i];
+
+        if(!opt.names.empty())
+            g.options.push_back(std::move(opt));
+    }
+
+    for(size_t i = 0; i < Usage::items.size(); i++) {
+        const Cmd& cmd = Usage::items[i];
+        ScriptGrammar::Command c{std::to_string(i), {}, cmd.args.size(), {},
+                                 {}};
+
+        if(!cmd.any) {
+            if(!impl::is_shell_word(cmd.name))
+                continue;
+
+            c.name = cmd.name;
+            g.names.append(cmd.name).append(" ");
+        }
+
+        for(const Param& p : cmd.options) {
+            uint32_t id = impl::find_option(p.val);
+
+            if(id != Handle::NO_SLOT)
+                c.options += words[id];
+        }
+
+        for(const ParamType& arg : cmd.args) {
+            std::string& choices = c.choices.emplace_back();
+
+            if(const auto* one = std::get_if<One>(&arg)) {
+                for(std::string_view x : one->items) {
+                    if(impl::is_shell_word(x))
+                        choices.append(x).append(" ");
+                }
+            }
+        }
+
+        g.commands.push_back(std::move(c));
+    }
+
+    if(!g.names.empty())
+        g.names.pop_back();
+
+    return g;
+}
+
+// bash and zsh share everything but reading words and adding candidates
+inline void sh_completion(std::string& out, std::string_view program,
+                          std::string_view fn, bool zsh) {
+    ScriptGrammar g = impl::script_grammar();
+    auto put = [&out](auto&&... s) { (out.append(s), ...); };
+
+    put("# ", zsh ? "zsh" : "bash", " completion for ", program,
+        ", generated by '", program, " ", COMPLETION_OPTION, "=",
+        zsh ? "zsh" : "bash", "'\n", fn, "() {\n");
+
+    if(zsh) {
+        put("    local cur=${words[CURRENT]} cmd=${words[2]} w name n=0 "
+            "skip=0\n"
+            "    local given=' ' dead=' ' cmds=' ' opts=' ' choices=' '\n"
+            "    local -a flags values\n\n"
+            "    if (( CURRENT == 2 )); then\n"
+            "        [[ $cur == -* ]] || compadd -- ",
+            g.names,
+            "\n        return\n"
+            "    fi\n\n"
+            "    for w in \"${(@)words[3,CURRENT-1]}\"; do\n");
+    }
+    else {
+        put("    local line=${COMP_LINE:0:COMP_POINT} cur cmd w name n=0 "
+            "skip=0\n"
+            "    local given=' ' dead=' ' cmds=' ' opts=' ' choices=' ' "
+            "cands=' '\n"
+            "    local -a words\n"
+            "    read -ra words <<< \"$line\"\n"
+            "    [[ -z $line || $line == *[[:space:]] ]] && words+=('')\n"
+            "    cur=${words[${#words[@]}-1]}\n"
+            "    cmd=${words[1]}\n"
+            "    COMPREPLY=()\n\n"
+            "    if (( ${#words[@]} == 2 )); then\n"
+            "        [[ $cur == -* ]] || COMPREPLY=($(compgen -W '",
+            g.names,
+            "' -- \"$cur\"))\n"
+            "        return\n"
+            "    fi\n\n"
+            "    for w in \"${words[@]:2:${#words[@]}-3}\"; do\n");
+    }
+
+    // Nothing is completed after '--', like complete()
+    put("        if (( skip )); then\n"
+        "            skip=0\n"
+        "        elif [[ $w == -- ]]; then\n"
+        "            return\n"
+        "        elif [[ $w == -* ]]; then\n"
+        "            name=${w#-}\n"
+        "            name=${name#-}\n"
+        "            name=${name%%=*}\n"
+        "            case $name in\n");
+
+    for(const ScriptGrammar::Option& o : g.options) {
+        put("                ");
+
+        for(size_t i = 0; i < o.names.size(); i++)
+            put(i ? "|" : "", o.names[i]);
+
+        put(") given+='", o.words, "'",
+            o.value ? "; [[ $w == --* ]] || skip=1" : "", " ;;\n");
+    }
+
+    put("            esac\n"
+        "        else\n");
+
+    // Any-commands not accepting a positional are dead
+    size_t maxargs = 0;
+
+    for(const ScriptGrammar::Command& c : g.commands) {
+        if(c.name.empty())
+            maxargs = std::max(maxargs, c.choices.size());
+    }
+
+    if(maxargs)
+        put("            case $n in\n");
+
+    for(size_t k = 0; k < maxargs; k++) {
+        std::string checks;
+
+        for(const ScriptGrammar::Command& c : g.commands) {
+            if(c.name.empty() && k < c.choices.size() &&
+               !c.choices[k].empty()) {
+                checks.append("                    [[ ' ")
+                    .append(c.choices[k])
+                    .append("' == *\" $w \"* ]] || dead+='")
+                    .append(c.id)
+                    .append(" '\n");
+            }
+        }
+
+        if(!checks.empty()) {
+            put("                ", std::to_string(k), ")\n", checks,
+                "                    ;;\n");
+        }
+    }
+
+    if(maxargs)
+        put("            esac\n");
+
+    put("            n=$((n + 1))\n"
+        "        fi\n"
+        "    done\n\n"
+        "    (( skip )) && return\n\n"
+        "    case $cmd in\n");
+
+    std::string anys;
+
+    for(const ScriptGrammar::Command& c : g.commands) {
+        if(c.name.empty())
+            anys.append(c.id).append(" ");
+        else
+            put("        ", c.name, ") cmds=' ", c.id, " ' ;;\n");
+    }
+
+    if(!anys.empty())
+        put("        *) cmds=' ", anys, "' ;;\n");
+
+    put("    esac\n");
+
+    for(const ScriptGrammar::Command& c : g.commands) {
+        bool choices = std::any_of(c.choices.begin(), c.choices.end(),
+                                   [](const auto& x) { return !x.empty(); });
+
+        if(c.options.empty() && !choices)
+            continue;
+
+        put("\n    if [[ $cmds == *' ", c.id, " '*");
+
+        if(c.name.empty()) {
+            put(" && $dead != *' ", c.id, " '* ]] && (( n <= ",
+                std::to_string(c.maxargs), " ))");
+        }
+        else
+            put(" ]]");
+
+        put("; then\n");
+
+        if(!c.options.empty())
+            put("        opts+='", c.options, "'\n");
+
+        if(choices) {
+            put("        case $n in\n");
+
+            for(size_t k = 0; k < c.choices.size(); k++) {
+                if(!c.choices[k].empty()) {
+                    put("            ", std::to_string(k), ") choices+='",
+                        c.choices[k], "' ;;\n");
+                }
+            }
+
+            put("        esac\n");
+        }
+
+        put("    fi\n");
+    }
+
+    put("\n    if [[ $cur == -* ]]; then\n"
+        "        [[ $cur == *=* ]] && return\n\n");
+
+    if(zsh) {
+        put("        for w in ${=opts}; do\n"
+            "            [[ $given == *\" $w \"* ]] && continue\n"
+            "            [[ $w == *= ]] && values+=($w) || flags+=($w)\n"
+            "        done\n\n"
+            "        compadd -- $flags\n"
+            "        compadd -S '' -- $values\n"
+            "    else\n"
+            "        compadd -- ${(u)=choices}\n"
+            "    fi\n"
+            "}\n\n"
+            "compdef ",
+            fn, " ", program, "\n");
+    }
+    else {
+        put("        for w in $opts; do\n"
+            "            [[ $given == *\" $w \"* ]] || cands+=\"$w \"\n"
+            "        done\n\n"
+            "        COMPREPLY=($(compgen -W \"$cands\" -- \"$cur\"))\n"
+            "        [[ ${COMPREPLY[0]} == *= ]] && compopt -o nospace\n"
+            "    else\n"
+            "        for w in $choices; do\n"
+            "            [[ $cands == *\" $w \"* ]] || cands+=\"$w \"\n"
+            "        done\n\n"
+            "        COMPREPLY=($(compgen -W \"$cands\" -- \"$cur\"))\n"
+            "    fi\n"
+            "}\n\n"
+            "complete -F ",
+            fn, " ", program, "\n");
+    }
+}
+
+inline void fish_completion(std::string& out, std::string_view program,
+                            std::string_view fn) {
+    ScriptGrammar g = impl::script_grammar();
+    auto put = [&out](auto&&... s) { (out.append(s), ...); };
+
+    put("# fish completion for ", program, ", generated by '", program, " ",
+        COMPLETION_OPTION, "=fish'\n", "function ", fn,
+        "\n"
+        "    set -l words (commandline -opc)\n"
+        "    set -l cur (commandline -ct)\n"
+        "    set -l n 0\n"
+        "    set -l skip 0\n"
+        "    set -l given\n"
+        "    set -l dead\n"
+        "    set -l cmds\n"
+        "    set -l opts\n"
+        "    set -l choices\n\n"
+        "    if test (count $words) -eq 1\n"
+        "        string match -q -- '-*' $cur; and return\n"
+        "        for w in ",
+        g.names,
+        "\n"
+        "            echo $w\n"
+        "        end\n"
+        "        return\n"
+        "    end\n\n"
+        "    if test (count $words) -gt 2\n"
+        "        for w in $words[3..-1]\n"
+        "            if test $skip -eq 1\n"
+        "                set skip 0\n"
+        "            else if test \"$w\" = --\n"
+        "                return\n"
+        "            else if string match -q -- '-*' $w\n"
+        "                switch (string replace -r -- '^--?([^=]*).*' '$1' "
+        "$w)\n");
+
+    for(const ScriptGrammar::Option& o : g.options) {
+        put("                    case");
+
+        for(std::string_view name : o.names)
+            put(" ", name);
+
+        put("\n                        set -a given ", o.words, "\n");
+
+        if(o.value) {
+            put("                        string match -q -- '--*' $w; or "
+                "set skip 1\n");
+        }
+    }
+
+    put("                end\n"
+        "            else\n"
+        "                switch $n\n");
+
+    size_t maxargs = 0;
+
+    for(const ScriptGrammar::Command& c : g.commands) {
+        if(c.name.empty())
+            maxargs = std::max(maxargs, c.choices.size());
+    }
+
+    for(size_t k = 0; k < maxargs; k++) {
+        std::string checks;
+
+        for(const ScriptGrammar::Command& c : g.commands) {
+            if(c.name.empty() && k < c.choices.size() &&
+               !c.choices[k].empty()) {
+                checks.append("                        contains -- $w ")
+                    .append(c.choices[k], 0, c.choices[k].size() - 1)
+                    .append("; or set -a dead ")
+                    .append(c.id)
+                    .append("\n");
+            }
+        }
+
+        if(!checks.empty())
+            put("                    case ", std::to_string(k), "\n", checks);
+    }
+
+    put("                end\n"
+        "                set n (math $n + 1)\n"
+        "            end\n"
+        "        end\n"
+        "    end\n\n"
+        "    test $skip -eq 1; and return\n\n"
+        "    switch $words[2]\n");
+
+    std::string anys;
+
+    for(const ScriptGrammar::Command& c : g.commands) {
+        if(c.name.empty())
+            anys.append(" ").append(c.id);
+        else
+            put("        case ", c.name, "\n            set cmds ", c.id, "\n");
+    }
+
+    if(!anys.empty())
+        put("        case '*'\n            set cmds", anys, "\n");
+
+    put("    end\n");
+
+    for(const ScriptGrammar::Command& c : g.commands) {
+        bool choices = std::any_of(c.choices.begin(), c.choices.end(),
+                                   [](const auto& x) { return !x.empty(); });
+
+        if(c.options.empty() && !choices)
+            continue;
+
+        put("\n    if contains -- ", c.id, " $cmds");
+
+        if(c.name.empty()) {
+            put("; and not contains -- ", c.id, " $dead; and test $n -le ",
+                std::to_string(c.maxargs));
+        }
+
+        put("\n");
+
+        if(!c.options.empty())
+            put("        set -a opts ", c.options, "\n");
+
+        if(choices) {
+            put("        switch $n\n");
+
+            for(size_t k = 0; k < c.choices.size(); k++) {
+                if(!c.choices[k].empty()) {
+                    put("            case ", std::to_string(k),
+                        "\n                set -a choices ", c.choices[k],
+                        "\n");
+                }
+            }
+
+            put("        end\n");
+        }
+
+        put("    end\n");
+    }
+
+    put("\n    if string match -q -- '-*' $cur\n"
+        "        string match -q -- '*=*' $cur; and return\n\n"
+        "        for w in $opts\n"
+        "            contains -- $w $given; or echo $w\n"
+        "        end\n"
+        "    else\n"
+        "        for w in $choices\n"
+        "            contains -- $w $given; and continue\n"
+        "            set -a given $w\n"
+        "            echo $w\n"
+        "        end\n"
+        "    end\n"
+        "end\n\n"
+        "complete -c ",
+        program, " -f -a '(", fn, ")'\n");
+}
+
+} // namespace impl
+
+/*
+ * A completion script for 'shell' (bash, zsh or fish), empty for other
+ * shells: the grammar is written into it, so completing never runs the
+ * program. 'program' defaults to the one given to set_program().
+ */
+#if defined(CL_DEFINE_API)
+CL_API std::string completion_script(std::string_view shell,
+                                     std::string_view program) {
+    if(program.empty())
+        program = impl::info.program;
+
+    std::string fn = "_cl_";
+    std::string out;
+
+    for(char ch : program)
+        fn += std::isalnum(static_cast<unsigned char>(ch)) ? ch : '_';
+
+    if(shell == "bash" || shell == "zsh")
+        impl::sh_completion(out, program, fn, shell == "zsh");
+    else if(shell == "fish")
+        impl::fish_completion(out, program, fn);
+
+    // Lists end with a space, trailing ones are dropped
+    size_t n = 0;
+
+    for(size_t i = 0; i < out.size(); i++) {
+        if(out[i] == '\n') {
+            while(n && out[n - 1] == ' ')
+                --n;
+        }
+
+        out[n++] = out[i];
+    }
+
+    out.resize(n);
+    return out;
+}
+#endif
+
+namespace impl {
+
+// Handles '--cl-completion=SHELL', the program is argv[0] without its path
+[[noreturn]] inline void completion_and_exit(int argc, char** argv) {
+    std::string_view arg = argv[1];
+
+    if(argc > 2 || arg.size() <= COMPLETION_OPTION.size() ||
+       arg[COMPLETION_OPTION.size()] != '=')
+        impl::print_and_exit("Invalid option '", arg, "'");
+
+    std::string_view shell = arg.substr(COMPLETION_OPTION.size() + 1);
+    std::string_view program = impl::info.program;
+
+    if(program == PROGRAM_DEFAULT && argv[0]) {
+        program = argv[0];
+        program = program.substr(program.rfind(Info::PATH_SEPARATOR) + 1);
+    }
+
+    std::string script = cl::completion_script(shell, program);
+
+    if(script.empty())
+        impl::print_and_exit("Unsupported shell '", shell, "'");
+
+    std::fputs(script.c_str(), stdout);
+    std::exit(0);
+}
+
+/*
+ * Set by cl::enable_builtins(): parse() only calls them through these
+ * pointers, so programs not enabling them link neither the batch reader
+ * nor the script generators.
+ */
+struct Builtins {
+    void (*batch)(int argc, char** argv){nullptr};
+    void (*completion)(int argc, char** argv){nullptr};
+};
+
+inline Builtins builtins;
+
+// Runs the enabled builtin named by argv[1], if any
+inline void run_builtins(int argc, char** argv, bool batch = true,
+                         bool completion = true) {
+    if(argc < 2)
+        return;
+
+    std::string_view c = argv[1];
+
+    if(batch && builtins.batch &&
+       c.substr(0, BATCH_OPTION.size()) == BATCH_OPTION)
+        builtins.batch(argc, argv);
+    if(completion && builtins.completion &&
+       c.substr(0, COMPLETION_OPTION.size()) == COMPLETION_OPTION)
+        builtins.completion(argc, argv);
+}
+
+} // namespace impl
+
+// parse(argc, argv) handles '--cl-batch' and '--cl-completion' from now on
+inline void enable_builtins() {
+    impl::builtins.batch = impl::batch_and_exit;
+    impl::builtins.completion = impl::completion_and_exit;
+}
+
+#if defined(CL_DEFINE_API)
+CL_API Args parse(int argc, char** argv) {
+    impl::run_builtins(argc, argv);
+
+    Result<Args> res = cl::try_parse(argc, argv);
+
+    if(!res)
+        impl::fail(res.error());
+
+    return std::move(*res);
+}
+
+CL_API Args parse(char* line, size_t size) {
+    Result<Args> res = cl::try_parse(line, size);
+
+    if(!res)
+        impl::fail(res.error());
+
+    return std::move(*res);
+}
+
+CL_API Args parse(std::string& line) {
+    return cl::parse(line.data(), line.size());
+}
+#endif
+
 namespace string_literals {
 
 inline impl::Cmd operator""_a(const char* arg, std::size_t len) {
@@ -0,0 +1,456 @@
+/*
+ *  _____  _
+ * /  __ \| |      Easy command line parsing with EDSL
+ * | /  \/| |      Parsed arguments and forward declarations
+ * | |    | |
+ * | \__/\| |____  https://github.com/Dax89/cl
+ *  \____/\_____/
+ *
+ * License: MIT
+ * https://github.com/Dax89/cl/blob/master/LICENSE
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/*
+ * With CL_COMPILED the entry points below are defined once, in the
+ * translation unit defining CL_IMPLEMENTATION before including cl.h
+ * (see src/cl.cpp), instead of being inline in every one.
+ */
+#if defined(CL_COMPILED)
+#define CL_API
+#else
+#define CL_API inline
+#endif
+
+namespace cl {
+
+struct Handle; // See cl.h
+
+namespace impl {
+
+constexpr uint64_t HASH_OFFSET = 14695981039346656037ULL;
+constexpr uint64_t HASH_PRIME = 1099511628211ULL;
+
+// FNV-1a
+constexpr uint64_t hash(std::string_view v, uint64_t h = HASH_OFFSET) {
+    for(char ch : v)
+        h = (h ^ static_cast<unsigned char>(ch)) * HASH_PRIME;
+
+    return h;
+}
+
+} // namespace impl
+
+// A string key with its hash, the _k literal computes it at compile time
+struct Key {
+    constexpr Key(std::string_view n): name{n}, hash{impl::hash(n)} {} // NOLINT
+    constexpr Key(const char* n): Key{std::string_view{n}} {}          // NOLINT
+    Key(const std::string& n): Key{std::string_view{n}} {}             // NOLINT
+
+    std::string_view name;
+    uint64_t hash;
+};
+
+namespace impl {
+
+struct Param;
+struct One;
+struct Rule;
+struct Bitset;
+
+using ParamType = std::variant<Param, One>;
+
+} // namespace impl
+
+struct Arg {
+    template<typename>
+    static constexpr bool always_false_v = false;
+
+    Arg() = default;
+
+    template<typename T>
+    explicit Arg(T t): v{t} {}
+
+    [[nodiscard]] bool is_null() const {
+        return std::holds_alternative<std::monostate>(v);
+    }
+
+    [[nodiscard]] bool is_bool() const {
+        return std::holds_alternative<bool>(v);
+    }
+
+    [[nodiscard]] bool is_int() const { return std::holds_alternative<int>(v); }
+
+    [[nodiscard]] bool is_string() const {
+        return std::holds_alternative<std::string_view>(v);
+    }
+
+    [[nodiscard]] bool to_bool() const { return std::get<bool>(v); }
+
+    [[nodiscard]] int to_int() const { return std::get<int>(v); }
+
+    [[nodiscard]] std::string_view to_stringview() const {
+        return std::get<std::string_view>(v);
+    }
+
+    [[nodiscard]] std::string to_string() const {
+        return std::string{std::get<std::string_view>(v)};
+    }
+
+    template<typename T>
+    bool operator==(T rhs) const {
+        using U = std::decay_t<T>;
+
+        if constexpr(std::is_null_pointer_v<T>)
+            return this->is_null();
+        if constexpr(std::is_convertible_v<U, std::string_view>)
+            return this->is_string() && this->to_stringview() == rhs;
+        else if constexpr(std::is_same_v<U, bool>)
+            return this->is_bool() && this->to_bool() == rhs;
+        else if constexpr(std::is_convertible_v<U, int>)
+            return this->is_int() && this->to_int() == rhs;
+        else
+            static_assert(Arg::always_false_v<U>);
+    }
+
+    template<typename T>
+    bool operator!=(T rhs) const {
+        return !this->operator==(rhs);
+    }
+
+    [[nodiscard]] std::string dump() const {
+        return std::visit(
+            [](auto& x) -> std::string {
+                using T = std::decay_t<decltype(x)>;
+
+                if constexpr(std::is_same_v<T, bool>)
+                    return x ? "true" : "false";
+                else if constexpr(std::is_same_v<T, int>)
+                    return std::to_string(x);
+                else if constexpr(std::is_same_v<T, std::string_view>)
+                    return "\"" + std::string{x} + "\"";
+                else if constexpr(std::is_same_v<T, std::monostate>)
+                    return "null";
+                else
+                    static_assert(Arg::always_false_v<T>);
+            },
+            v);
+    }
+
+    explicit operator bool() const { return !this->is_null(); }
+
+    std::variant<std::monostate, bool, int, std::string_view> v;
+};
+
+/*
+ * Iterates (key, value) pairs, keys come from the symbol table. The pair
+ * is kept in the iterator so that 'auto& [k, v]' binds and 'it->second'
+ * works, references to it are valid until the iterator is incremented.
+ */
+template<typename A>
+struct ArgsIterator {
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::pair<std::string_view, A&>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type*;
+    using reference = value_type&;
+
+    ArgsIterator() = default;
+    ArgsIterator(A* a, const std::string_view* k): arg{a}, key{k} {}
+    ArgsIterator(const ArgsIterator& rhs): arg{rhs.arg}, key{rhs.key} {}
+
+    // The pair holds a reference, it is rebuilt rather than assigned
+    ArgsIterator& operator=(const ArgsIterator& rhs) {
+        arg = rhs.arg;
+        key = rhs.key;
+        entry.reset();
+        return *this;
+    }
+
+    reference operator*() const {
+        if(!entry || &entry->second != arg)
+            entry.emplace(*key, *arg);
+
+        return *entry;
+    }
+
+    pointer operator->() const { return &this->operator*(); }
+
+    ArgsIterator& operator++() {
+        ++arg;
+        ++key;
+        return *this;
+    }
+
+    bool operator==(const ArgsIterator& rhs) const { return arg == rhs.arg; }
+    bool operator!=(const ArgsIterator& rhs) const { return arg != rhs.arg; }
+
+    A* arg{nullptr};
+    const std::string_view* key{nullptr};
+
+private:
+    mutable std::optional<value_type> entry;
+};
+
+// A name outside the table of an open option family
+struct FamilyName {
+    uint32_t slot; // Family option id
+    std::string_view name;
+    bool enabled;
+};
+
+/*
+ * Arguments after the '--' terminator, they are not parsed. From argv
+ * it is a view of its tail: argv is NULL terminated, so 'argv' can be
+ * passed to execvp() as is. From a line, 'line' is the rest of it as
+ * written.
+ */
+struct Rest {
+    [[nodiscard]] bool empty() const { return !argc && line.empty(); }
+    [[nodiscard]] size_t size() const { return static_cast<size_t>(argc); }
+    [[nodiscard]] char** begin() const { return argv; }
+    [[nodiscard]] char** end() const { return argv + argc; }
+    std::string_view operator[](size_t i) const { return argv[i]; }
+
+    char** argv{nullptr};
+    int argc{0};
+    std::string_view line;
+};
+
+namespace impl {
+
+/*
+ * Lazy default values computed by an Args: a list shared by its copies,
+ * each one prepends the values it computes (see cl.h).
+ */
+struct Computed {
+    struct Node;
+
+    Computed() = default;
+    Computed(const Computed& rhs);
+    Computed(Computed&& rhs) noexcept: head{rhs.head} { rhs.head = nullptr; }
+    Computed& operator=(const Computed& rhs);
+
+    Computed& operator=(Computed&& rhs) noexcept {
+        std::swap(head, rhs.head);
+        return *this;
+    }
+
+    ~Computed();
+
+    // Stores 's', the view stays valid as long as a copy refers to it
+    std::string_view add(std::string s);
+
+    Node* head{nullptr};
+};
+
+} // namespace impl
+
+/*
+ * Parsed arguments: one value per symbol id, in grammar order.
+ * Handles index them directly, string keys go through the symbol table
+ * (precomputed with the _k literal); unknown keys read as null and
+ * writes to them are dropped, since there is no slot to store them.
+ * Members reading the symbol table are defined in cl.h.
+ */
+struct Args {
+    using value_type = std::pair<std::string_view, Arg&>;
+    using iterator = ArgsIterator<Arg>;
+    using const_iterator = ArgsIterator<const Arg>;
+
+    [[nodiscard]] bool empty() const { return values.empty(); }
+    [[nodiscard]] size_t size() const { return values.size(); }
+
+    // Iterating reads every value, lazy defaults are computed first
+    iterator begin();
+    iterator end();
+    [[nodiscard]] const_iterator begin() const;
+    [[nodiscard]] const_iterator end() const;
+
+    Arg& operator[](size_t slot) { return this->get(slot); }
+    const Arg& operator[](size_t slot) const { return this->get(slot); }
+    Arg& operator[](const Handle& h);
+    const Arg& operator[](const Handle& h) const;
+
+    Arg& operator[](const Key& key) {
+        size_t slot = this->slot(key);
+
+        if(slot < values.size())
+            return this->get(slot);
+
+        none = Arg{};
+        return none;
+    }
+
+    const Arg& operator[](const Key& key) const {
+        size_t slot = this->slot(key);
+        return slot < values.size() ? this->get(slot) : NONE;
+    }
+
+    [[nodiscard]] const Arg& at(const Key& key) const {
+        size_t slot = this->slot(key);
+
+        if(slot >= values.size())
+            throw std::out_of_range{"cl::Args::at"};
+
+        return this->get(slot);
+    }
+
+    /*
+     * Computes the lazy defaults not read yet: reads are not thread safe
+     * until then, since the first one stores the value.
+     */
+    void resolve() const {
+        for(size_t w = 0; w < pending.size(); w++) {
+            for(size_t i = w * 64; pending[w]; i++)
+                this->get(i);
+        }
+    }
+
+    [[nodiscard]] size_t count(const Key& key) const {
+        return this->slot(key) < values.size();
+    }
+
+    [[nodiscard]] const_iterator find(const Key& key) const;
+    [[nodiscard]] size_t slot(const Key& key) const;
+
+    // A name of an option family: true if enabled ('-fname'), false if
+    // disabled ('-fno-name'), nullopt if not given. The last one wins.
+    [[nodiscard]] std::optional<bool> flag(const Key& family,
+                                           const Key& name) const;
+
+    static inline const Arg NONE{};
+
+    mutable std::vector<Arg> values; // Lazy defaults are set on first read
+    std::vector<uint64_t> flags;     // Option families, see FamilyTable
+    std::vector<FamilyName> others;  // Open families, in command line order
+    Rest rest;                       // After '--'
+    Arg none;
+
+    mutable std::vector<uint64_t> pending; // Lazy defaults not computed yet
+
+private:
+    Arg& get(size_t slot) const {
+        size_t w = slot >> 6;
+
+        if(w < pending.size() && ((pending[w] >> (slot & 63)) & 1))
+            this->compute(slot);
+
+        return values[slot];
+    }
+
+    void compute(size_t slot) const;
+
+    // Only symbols of the current grammar can be iterated
+    [[nodiscard]] size_t length() const;
+
+    template<typename A>
+    static ArgsIterator<A> at_slot(A* values, size_t slot);
+
+    mutable impl::Computed computed;
+};
+
+enum class ErrorCode {
+    NONE = 0,
+    HELP,
+    VERSION,
+    UNKNOWN_COMMAND,
+    INVALID_OPTION,
+    INVALID_OPTION_FORMAT,
+    INVALID_SHORT_OPTION_FORMAT,
+    INVALID_ARGUMENT,
+    MISSING_ARGUMENT,
+    MISSING_OPTION,
+    TOO_MANY_ARGUMENTS,
+    INVALID_QUOTING,
+    INVALID_VALUE,
+    UNEXPECTED_OPTION,
+    AMBIGUOUS_COMMAND,
+    AMBIGUOUS_OPTION,
+    CONFLICTING_OPTIONS,
+    MISSING_DEPENDENCY,
+    MISSING_OPTION_GROUP,
+};
+
+/*
+ * A parse failure: it only holds views into argv and into the grammar,
+ * the human readable message is built on request.
+ */
+struct Error {
+    ErrorCode code{ErrorCode::NONE};
+    int index{0}; // argv index of the offending token (argc if missing)
+    std::string_view token{};
+    const impl::ParamType* param{nullptr}; // Missing positional, if any
+    const impl::Rule* rule{nullptr};       // Violated rule, if any
+    std::string_view other{}; // Conflicting or needed option, if any
+    const impl::Bitset* allowed{nullptr}; // Options of the command, if known
+    std::string reason{}; // Given by the Validator of a rejected value
+
+    [[nodiscard]] std::string message() const;
+};
+
+template<typename T>
+struct Result {
+    Result(T t): v{std::move(t)} {} // NOLINT
+    Result(Error e): v{e} {}        // NOLINT
+
+    [[nodiscard]] bool has_value() const { return v.index() == 0; }
+    explicit operator bool() const { return this->has_value(); }
+
+    T& value() { return std::get<0>(v); }
+    [[nodiscard]] const T& value() const { return std::get<0>(v); }
+    [[nodiscard]] const Error& error() const { return std::get<1>(v); }
+
+    T& operator*() { return this->value(); }
+    const T& operator*() const { return this->value(); }
+    T* operator->() { return &this->value(); }
+    const T* operator->() const { return &this->value(); }
+
+    std::variant<T, Error> v;
+};
+
+namespace impl {
+
+CL_API void version();
+CL_API void help();
+
+} // namespace impl
+
+CL_API void help();
+
+// Exits on errors, '--help' and '--version'
+CL_API Args parse(int argc, char** argv);
+CL_API Args parse(char* line, size_t size);
+CL_API Args parse(std::string& line);
+
+CL_API Result<Args> try_parse(int argc, char** argv);
+CL_API Result<Args> try_parse(char* line, size_t size);
+CL_API Result<Args> try_parse(std::string& line);
+
+CL_API size_t batch(std::FILE* f, bool keepgoing = false);
+
+CL_API std::string completion_script(std::string_view shell,
+                                     std::string_view program = {});
+
+namespace string_literals {
+
+constexpr Key operator""_k(const char* arg, std::size_t len) {
+    return Key{std::string_view{arg, len}};
+}
+
+} // namespace string_literals
+
+} // namespace cl
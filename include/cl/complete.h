@@ -0,0 +1,204 @@
+/*
+ *  _____  _
+ * /  __ \| |      Easy command line parsing with EDSL
+ * | /  \/| |      Completion of commands, options and choices
+ * | |    | |
+ * | \__/\| |____  https://github.com/Dax89/cl
+ *  \____/\_____/
+ *
+ * License: MIT
+ * https://github.com/Dax89/cl/blob/master/LICENSE
+ */
+
+#pragma once
+
+#include <cl/cl.h>
+
+namespace cl {
+
+namespace impl {
+
+/*
+ * Short names and choices, sorted on the first completion: candidates
+ * are found with a binary search for the prefix and a scan of the
+ * matching range only. Long names and commands come from the layout.
+ */
+struct Completions {
+    SortedNames shortoptions; // Options::items index
+
+    // Choice ids of each command positional, empty for free values
+    std::vector<std::vector<SortedNames>> choices;
+    uint64_t grammar{0};
+    bool built{false};
+};
+
+inline Completions completions;
+
+inline const Completions& completion_index() {
+    Completions& c = impl::completions;
+
+    if(c.built && c.grammar == layout.fingerprint)
+        return c;
+
+    c.shortoptions.clear();
+    c.choices.clear();
+
+    for(size_t i = 0; i < Usage::items.size(); i++) {
+        const Cmd& cmd = Usage::items[i];
+        auto& choices = c.choices.emplace_back(cmd.args.size());
+
+        for(size_t k = 0; k < cmd.args.size(); k++) {
+            const auto* one = std::get_if<One>(&cmd.args[k]);
+
+            if(!one)
+                continue;
+
+            for(size_t j = 0; j < one->items.size(); j++)
+                choices[k].emplace_back(one->items[j], *one->slots[j]);
+
+            std::sort(choices[k].begin(), choices[k].end());
+        }
+    }
+
+    // Only names that find_option() resolves
+    for(size_t i = 0; i < Options::items.size(); i++) {
+        const Opt& o = Options::items[i];
+
+        if(o.shortname.size() > 1 && !o.family)
+            c.shortoptions.emplace_back(o.shortname, static_cast<uint32_t>(i));
+    }
+
+    std::sort(c.shortoptions.begin(), c.shortoptions.end());
+
+    c.grammar = layout.fingerprint;
+    c.built = true;
+    return c;
+}
+
+} // namespace impl
+
+/*
+ * Candidates for argv[cursor] (an empty word if cursor == argc): command
+ * names, options allowed for the command and not given yet, or the
+ * choices of the current positional. Option and free values have none.
+ * Candidates are sorted within each kind.
+ */
+inline std::vector<std::string> complete(int argc, char** argv, int cursor) {
+    std::vector<std::string> res;
+
+    if(cursor < 1 || cursor > argc)
+        return res;
+
+    impl::finalize();
+    const impl::Completions& c = impl::completion_index();
+    std::string_view word = cursor < argc ? argv[cursor] : "";
+    bool option = !word.empty() && word.front() == '-';
+
+    auto add = [&res](std::string_view dashes, std::string_view name) {
+        res.emplace_back(dashes).append(name);
+    };
+
+    if(cursor == 1) {
+        if(!option) {
+            impl::for_prefix(impl::layout.cmdnames, word,
+                             [&](std::string_view n, uint32_t) { add("", n); });
+        }
+
+        return res;
+    }
+
+    // Words between the command and the cursor, as the parser sees them
+    impl::Scratch scratch;
+    scratch.given.reset(Options::items.size());
+    scratch.allowed = impl::named_options(argv[1]);
+    impl::ArgvTokens tokens{cursor, argv};
+    tokens.index = 2;
+    impl::Token t;
+
+    while(tokens.next(t)) {
+        if(t.val == impl::TERMINATOR)
+            return res; // Passed through, nothing to complete
+
+        Error err = impl::match_token(tokens, t, scratch);
+
+        if(err.code == ErrorCode::INVALID_SHORT_OPTION_FORMAT)
+            return res; // 'word' is the value of a short option
+    }
+
+    // An any-command is a candidate while it accepts the positionals
+    std::vector<uint32_t> cmds;
+    uint32_t named = impl::find_command(argv[1]);
+
+    if(named != Handle::NO_SLOT && !Usage::items[named].any)
+        cmds.push_back(named);
+    else {
+        for(uint32_t i : impl::layout.anys) {
+            const impl::Signature& sig = impl::layout.signatures[i];
+            const auto& margs = scratch.positionals;
+            bool alive = margs.size() <= sig.maxargs;
+
+            for(size_t k = 0; alive && k < margs.size(); k++) {
+                alive = impl::accepts(sig.choices[k], margs[k].val,
+                                      k < sig.minargs);
+            }
+
+            if(alive)
+                cmds.push_back(i);
+        }
+    }
+
+    auto allowed = [&](uint32_t id) {
+        if(scratch.given.test(id))
+            return false;
+
+        for(uint32_t i : cmds) {
+            if(impl::layout.signatures[i].allowed.test(id))
+                return true;
+        }
+
+        return false;
+    };
+
+    if(option) {
+        if(word.find('=') != std::string_view::npos)
+            return res;
+
+        bool islong = word.size() > 1 && word[1] == '-';
+
+        if(word.size() == 1 || !islong) {
+            impl::for_prefix(c.shortoptions, word.substr(1),
+                             [&](std::string_view n, uint32_t id) {
+                                 if(allowed(id))
+                                     add("-", n);
+                             });
+        }
+
+        if(word.size() == 1 || islong) {
+            impl::for_prefix(impl::layout.longnames, impl::strip_dash(word),
+                             [&](std::string_view n, uint32_t id) {
+                                 if(allowed(id))
+                                     add("--", n);
+                             });
+        }
+
+        return res;
+    }
+
+    size_t slot = scratch.positionals.size();
+
+    for(uint32_t i : cmds) {
+        if(slot < c.choices[i].size()) {
+            impl::for_prefix(c.choices[i][slot], word,
+                             [&](std::string_view n, uint32_t) { add("", n); });
+        }
+    }
+
+    if(cmds.size() > 1) {
+        std::sort(res.begin(), res.end());
+        res.erase(std::unique(res.begin(), res.end()), res.end());
+    }
+
+    return res;
+}
+
+} // namespace cl
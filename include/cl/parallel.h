@@ -0,0 +1,357 @@
+/*
+ *  _____  _
+ * /  __ \| |      Easy command line parsing with EDSL
+ * | /  \/| |      Parallel dispatch of command entries
+ * | |    | |
+ * | \__/\| |____  https://github.com/Dax89/cl
+ *  \____/\_____/
+ *
+ * License: MIT
+ * https://github.com/Dax89/cl/blob/master/LICENSE
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cl/cl.h>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace cl {
+
+/*
+ * A parsed command line owning its text: unlike the Args returned by
+ * parse() it can be stored and moved between threads.
+ */
+struct Invocation {
+    void operator()() const {
+        if(command && command->entry)
+            command->entry(args);
+    }
+
+    std::unique_ptr<char[]> line;
+    Args args;
+    const impl::Cmd* command{nullptr};
+};
+
+using OrderKey = std::function<std::string_view(const Args&)>;
+
+namespace impl {
+
+using Task = std::function<void()>;
+
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+};
+
+// Invocations sharing an ordering key, dispatched one at a time
+struct Strand {
+    std::string key;
+    std::mutex mutex;
+    std::deque<Invocation> invocations;
+    bool running{false};
+};
+
+// Copies the (already unescaped) record and points 'args' to the copy
+inline Invocation make_invocation(const char* b, const char* e, Args&& args,
+                                  const Cmd* command) {
+    Invocation inv;
+    auto size = static_cast<size_t>(e - b);
+
+    inv.line = std::make_unique<char[]>(size ? size : 1);
+    std::memcpy(inv.line.get(), b, size);
+    inv.args = std::move(args);
+    inv.command = command;
+
+    std::less_equal<const char*> le;
+
+    auto rebase = [&](std::string_view& sv) {
+        if(le(b, sv.data()) && le(sv.data() + sv.size(), e))
+            sv = {inv.line.get() + (sv.data() - b), sv.size()};
+    };
+
+    for(Arg& a : inv.args.values) {
+        if(auto* sv = std::get_if<std::string_view>(&a.v))
+            rebase(*sv);
+    }
+
+    for(FamilyName& n : inv.args.others)
+        rebase(n.name);
+
+    rebase(inv.args.rest.line);
+
+    return inv;
+}
+
+} // namespace impl
+
+/*
+ * Like try_parse() but the matched entry is not called, the returned
+ * Invocation does it. Errors refer to 'line', which is unescaped in place.
+ */
+inline Result<Invocation> try_parse_invocation(char* line, size_t size) {
+    impl::LineTokens tokens{line, line + size};
+    impl::Scratch scratch;
+    Result<Args> res = impl::parse(tokens, scratch);
+
+    if(!res)
+        return res.error();
+
+    return impl::make_invocation(line, line + size, std::move(*res),
+                                 scratch.command);
+}
+
+inline Result<Invocation> try_parse_invocation(std::string& line) {
+    return cl::try_parse_invocation(line.data(), line.size());
+}
+
+/*
+ * Work-stealing thread pool running Invocations: each worker serves its
+ * own queue first and steals from the others when it runs out of work.
+ * The grammar is finalized on construction and must not change while
+ * the dispatcher is alive.
+ */
+struct Dispatcher {
+    explicit Dispatcher(
+        size_t concurrency = std::thread::hardware_concurrency()) {
+        impl::finalize();
+
+        if(!concurrency)
+            concurrency = 1;
+
+        for(size_t i = 0; i < concurrency; i++)
+            queues.push_back(std::make_unique<impl::WorkQueue>());
+
+        for(size_t i = 0; i < concurrency; i++)
+            threads.emplace_back([this, i]() { this->run(i); });
+    }
+
+    Dispatcher(const Dispatcher&) = delete;
+    Dispatcher& operator=(const Dispatcher&) = delete;
+
+    ~Dispatcher() {
+        this->wait();
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            stop = true;
+        }
+
+        wakeup.notify_all();
+
+        for(std::thread& t : threads)
+            t.join();
+    }
+
+    void submit(Invocation&& inv) {
+        auto p = std::make_shared<Invocation>(std::move(inv));
+        this->push([p]() { (*p)(); });
+    }
+
+    // Invocations with the same key run one at a time, in submission order
+    void submit(Invocation&& inv, std::string_view key) {
+        if(key.empty()) {
+            this->submit(std::move(inv));
+            return;
+        }
+
+        // Held until queued: an idle strand is erased by next_of()
+        std::lock_guard<std::mutex> lock{strandsmutex};
+        auto& s = strands[std::string{key}];
+
+        if(!s) {
+            s = std::make_unique<impl::Strand>();
+            s->key = key;
+        }
+
+        impl::Strand* strand = s.get();
+        std::lock_guard<std::mutex> slock{strand->mutex};
+        strand->invocations.push_back(std::move(inv));
+
+        if(!strand->running) {
+            strand->running = true;
+            this->push([this, strand]() { this->drain(strand); });
+        }
+    }
+
+    // Runs 'task' on the pool, wait() waits for it too
+    void post(std::function<void()>&& task) { this->push(std::move(task)); }
+
+    // Waits until every submitted invocation has been dispatched
+    void wait() {
+        std::unique_lock<std::mutex> lock{mutex};
+        done.wait(lock, [this]() { return !pending; });
+    }
+
+private:
+    void push(impl::Task&& t) {
+        impl::WorkQueue& q = *queues[next++ % queues.size()];
+
+        {
+            // Count first: a worker may pop the task as soon as it is queued
+            std::lock_guard<std::mutex> lock{mutex};
+            ++pending;
+            ++queued;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{q.mutex};
+            q.tasks.push_back(std::move(t));
+        }
+
+        wakeup.notify_one();
+    }
+
+    bool pop(size_t idx, impl::Task& t) {
+        for(size_t i = 0; i < queues.size(); i++) {
+            impl::WorkQueue& q = *queues[(idx + i) % queues.size()];
+            std::lock_guard<std::mutex> lock{q.mutex};
+
+            if(q.tasks.empty())
+                continue;
+
+            if(!i) { // Own queue: oldest first
+                t = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            else { // Steal the newest one
+                t = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+    void run(size_t idx) {
+        impl::Task t;
+
+        for(;;) {
+            if(!this->pop(idx, t)) {
+                std::unique_lock<std::mutex> lock{mutex};
+                wakeup.wait(lock, [this]() { return stop || queued; });
+
+                if(stop && !queued)
+                    return;
+
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                --queued;
+            }
+
+            // An entry that throws does not stop the worker
+            try {
+                t();
+            }
+            catch(const std::exception& e) {
+                impl::print("ERROR: ", e.what());
+            }
+            catch(...) {
+                impl::print("ERROR: Unknown exception");
+            }
+
+            t = nullptr;
+
+            std::lock_guard<std::mutex> lock{mutex};
+
+            if(!--pending)
+                done.notify_all();
+        }
+    }
+
+    void drain(impl::Strand* strand) {
+        Invocation inv;
+
+        {
+            std::lock_guard<std::mutex> lock{strand->mutex};
+            inv = std::move(strand->invocations.front());
+            strand->invocations.pop_front();
+        }
+
+        try {
+            inv();
+        }
+        catch(...) {
+            this->next_of(strand);
+            throw;
+        }
+
+        this->next_of(strand);
+    }
+
+    // Dispatches the next invocation of 'strand', erases it when idle
+    void next_of(impl::Strand* strand) {
+        std::lock_guard<std::mutex> lock{strandsmutex};
+
+        {
+            std::lock_guard<std::mutex> slock{strand->mutex};
+
+            if(!strand->invocations.empty()) {
+                this->push([this, strand]() { this->drain(strand); });
+                return;
+            }
+        }
+
+        strands.erase(strand->key); // The next submit() creates it again
+    }
+
+    std::vector<std::unique_ptr<impl::WorkQueue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex strandsmutex;
+    std::unordered_map<std::string, std::unique_ptr<impl::Strand>> strands;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::condition_variable done;
+    std::atomic<size_t> next{0};
+    size_t pending{0};
+    size_t queued{0};
+    bool stop{false};
+};
+
+/*
+ * Parallel version of batch(): records are parsed sequentially and their
+ * entries dispatched on up to 'concurrency' threads. Records for which
+ * 'key' returns the same non-empty value are dispatched in order.
+ */
+inline size_t batch_parallel(std::FILE* f, size_t concurrency,
+                             const OrderKey& key = nullptr,
+                             bool keepgoing = false) {
+    Dispatcher dispatcher{concurrency};
+    impl::Scratch scratch;
+    size_t failed = 0;
+
+    impl::read_records(f, [&](char* b, char* e, size_t lineno) {
+        impl::LineTokens tokens{b, e};
+        Result<Args> res = impl::parse(tokens, scratch);
+
+        if(res) {
+            Invocation inv =
+                impl::make_invocation(b, e, std::move(*res), scratch.command);
+
+            std::string_view k = key ? key(inv.args) : std::string_view{};
+            dispatcher.submit(std::move(inv), k);
+            return true;
+        }
+
+        if(impl::report(res.error(), lineno))
+            return true;
+
+        ++failed;
+        return keepgoing;
+    });
+
+    return failed;
+}
+
+} // namespace cl
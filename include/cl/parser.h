@@ -0,0 +1,148 @@
+/*
+ *  _____  _
+ * /  __ \| |      Easy command line parsing with EDSL
+ * | /  \/| |      Policy-based parser for small binaries
+ * | |    | |
+ * | \__/\| |____  https://github.com/Dax89/cl
+ *  \____/\_____/
+ *
+ * License: MIT
+ * https://github.com/Dax89/cl/blob/master/LICENSE
+ */
+
+#pragma once
+
+#include <cl/cl.h>
+
+namespace cl {
+
+// Policies, each one compiles a feature out of Parser
+struct NoHelp {};       // No usage and version output
+struct NoMessages {};   // Errors exit without a message or suggestions
+struct NoEntry {};      // Command entries are not called
+struct NoBatch {};      // No builtin '--cl-batch' mode, even if enabled
+struct NoCompletion {}; // No builtin '--cl-completion', even if enabled
+struct FlagsOnly {};    // Options never take a value
+
+namespace impl {
+
+template<typename P, typename... Policies>
+constexpr bool has_policy = (std::is_same_v<P, Policies> || ...);
+
+} // namespace impl
+
+/*
+ * Same as cl::parse() and cl::try_parse() by default, only the code
+ * needed by the enabled features is instantiated:
+ *
+ *   using Parser = cl::Parser<cl::NoHelp, cl::NoEntry, cl::FlagsOnly>;
+ *   cl::Args args = Parser::parse(argc, argv);
+ */
+template<typename... Policies>
+struct Parser {
+    static constexpr bool HELP = !impl::has_policy<NoHelp, Policies...>;
+    static constexpr bool MESSAGES = !impl::has_policy<NoMessages, Policies...>;
+    static constexpr bool ENTRY = !impl::has_policy<NoEntry, Policies...>;
+    static constexpr bool BATCH = !impl::has_policy<NoBatch, Policies...>;
+    static constexpr bool COMPLETION =
+        !impl::has_policy<NoCompletion, Policies...>;
+    static constexpr bool VALUES = !impl::has_policy<FlagsOnly, Policies...>;
+
+    static Result<Args> try_parse(int argc, char** argv) {
+        impl::ArgvTokens tokens{argc, argv};
+        return Parser::run(tokens);
+    }
+
+    // The buffer is unescaped in place, returned Args refer to it
+    static Result<Args> try_parse(std::string& line) {
+        impl::LineTokens tokens{line.data(), line.data() + line.size()};
+        return Parser::run(tokens);
+    }
+
+    static Args parse(int argc, char** argv) {
+        impl::run_builtins(argc, argv, BATCH, COMPLETION);
+
+        Result<Args> res = Parser::try_parse(argc, argv);
+
+        if(!res)
+            Parser::fail(res.error());
+
+        return std::move(*res);
+    }
+
+    static Args parse(std::string& line) {
+        Result<Args> res = Parser::try_parse(line);
+
+        if(!res)
+            Parser::fail(res.error());
+
+        return std::move(*res);
+    }
+
+    // Exit codes are the same of cl::parse()
+    [[noreturn]] static void fail(const Error& e) {
+        if constexpr(HELP && MESSAGES)
+            impl::fail(e);
+        else {
+            switch(e.code) {
+                case ErrorCode::NONE: impl::abort();
+
+                case ErrorCode::HELP:
+                case ErrorCode::TOO_MANY_ARGUMENTS:
+                    if constexpr(HELP)
+                        impl::help_and_exit();
+                    else {
+                        if(e.code == ErrorCode::TOO_MANY_ARGUMENTS)
+                            Parser::message(e);
+
+                        std::exit(1);
+                    }
+
+                case ErrorCode::VERSION:
+                    if constexpr(HELP)
+                        impl::version_and_exit();
+                    else
+                        std::exit(1);
+
+                default: break;
+            }
+
+            if constexpr(MESSAGES)
+                Parser::message(e);
+            else if constexpr(HELP) {
+                if(cl::help_on_exit)
+                    impl::help();
+            }
+
+            std::exit(2);
+        }
+    }
+
+private:
+    static void message(const Error& e) {
+        if constexpr(MESSAGES) {
+            std::string msg = impl::describe(e);
+
+            if(e.code != ErrorCode::UNKNOWN_COMMAND)
+                std::fputs("ERROR: ", stdout);
+
+            std::fputs(msg.c_str(), stdout);
+            std::fputs("\n", stdout);
+        }
+    }
+
+    template<typename Tokens>
+    static Result<Args> run(Tokens& tokens) {
+        impl::Scratch scratch;
+        Result<Args> res = impl::parse<VALUES>(tokens, scratch);
+
+        if constexpr(ENTRY) {
+            if(res)
+                impl::dispatch(scratch, *res);
+        }
+
+        return res;
+    }
+};
+
+} // namespace cl
@@ -0,0 +1,351 @@
+/*
+ *  _____  _
+ * /  __ \| |      Easy command line parsing with EDSL
+ * | /  \/| |      Incremental parsing of a line being edited
+ * | |    | |
+ * | \__/\| |____  https://github.com/Dax89/cl
+ *  \____/\_____/
+ *
+ * License: MIT
+ * https://github.com/Dax89/cl/blob/master/LICENSE
+ */
+
+#pragma once
+
+#include <cl/cl.h>
+#include <cstring>
+
+namespace cl {
+
+enum class TokenKind {
+    COMMAND,
+    ARGUMENT,
+    OPTION,
+    VALUE, // Value of a short option
+};
+
+// A token of the edited line, offsets refer to the line as written
+struct LineToken {
+    size_t begin;
+    size_t end;
+    TokenKind kind;
+    std::string_view val; // Unescaped
+};
+
+namespace impl {
+
+// Serves the tokens of a LineParser to match_token()
+struct VectorTokens {
+    bool next(Token& t) {
+        if(index - 1 >= static_cast<int>(tokens.size()))
+            return false;
+
+        t = Token{tokens[index - 1].val, index};
+        ++index;
+        return true;
+    }
+
+    const std::vector<LineToken>& tokens;
+    int index;
+    Error error;
+};
+
+} // namespace impl
+
+/*
+ * Parses a line while it is edited (eg. in an interactive shell): when
+ * the line changes, the tokens of the unchanged prefix are kept and only
+ * the rest is tokenized and matched again, then the command is checked
+ * against its signature. Errors are returned, it never exits.
+ * Command entries are not called.
+ */
+struct LineParser {
+    static constexpr size_t NO_SEPARATOR = ~size_t{0};
+    static constexpr size_t DEFAULT_CAPACITY = 256;
+
+    // Lines longer than 'capacity' make the next update() start over
+    explicit LineParser(size_t capacity = DEFAULT_CAPACITY) {
+        buffer.reserve(capacity);
+    }
+
+    const Error& update(std::string_view line) {
+        impl::finalize();
+
+        size_t prefix = 0;
+        size_t n = std::min(line.size(), text.size());
+
+        while(prefix < n && line[prefix] == text[prefix])
+            ++prefix;
+
+        if(grammar != impl::layout.fingerprint ||
+           line.size() > buffer.capacity()) {
+            grammar = impl::layout.fingerprint;
+            buffer.reserve(std::max(line.size(), buffer.capacity() * 2));
+            prefix = 0;
+        }
+
+        this->truncate(prefix);
+        text.assign(line);
+
+        size_t restart = items.empty() ? 0 : next[items.size() - 1];
+        buffer.resize(line.size());
+        std::memcpy(buffer.data() + restart, line.data() + restart,
+                    line.size() - restart);
+
+        // Like the parser, nothing is tokenized after '--'
+        if(terminator == NO_STEP) {
+            bool more = this->tokenize(restart);
+            this->scan();
+
+            // It was the value of a short option
+            while(more && terminator == NO_STEP &&
+                  next.back() != NO_SEPARATOR) {
+                more = this->tokenize(next.back());
+                this->scan();
+            }
+        }
+
+        if(terminator != NO_STEP)
+            this->add_rest();
+
+        if(firsterror != NO_STEP)
+            result = steps[firsterror].error;
+        else if(tokenerror.code != ErrorCode::NONE)
+            result = tokenerror;
+        else if(items.empty()) {
+            result = Usage::items.empty() ? Error{}
+                                          : Error{ErrorCode::HELP};
+        }
+        else {
+            scratch.command = nullptr;
+            impl::Token first{items[0].val, 1};
+            size_t argc = std::min(items.size(), terminator) + 1;
+            result = impl::match_command(scratch, first,
+                                         static_cast<int>(argc));
+
+            // Validators run on every update, as in try_parse()
+            if(result.code == ErrorCode::NONE && scratch.command)
+                result = impl::check_values(scratch);
+        }
+
+        return result;
+    }
+
+    [[nodiscard]] const Error& error() const { return result; }
+    [[nodiscard]] const std::vector<LineToken>& tokens() const { return items; }
+
+    // Built on request, values refer to the parser: they are valid until
+    // the next update()
+    [[nodiscard]] Result<Args> args() const {
+        if(result.code != ErrorCode::NONE)
+            return result;
+
+        if(!scratch.command)
+            return Args{};
+
+        Args v = impl::init_value(impl::signature(*scratch.command).lazy);
+
+        impl::fill(scratch, [&v](uint32_t slot, const Arg& arg, int) {
+            v.values[slot] = arg;
+        });
+
+        impl::fill_families(scratch, v);
+
+        // The line after '--', as written
+        if(terminator != NO_STEP && next[terminator] != NO_SEPARATOR) {
+            std::string_view rest = text;
+            rest.remove_prefix(next[terminator]);
+
+            while(!rest.empty() && impl::LineTokens::is_space(rest.front()))
+                rest.remove_prefix(1);
+
+            v.rest.line = rest;
+        }
+
+        return v;
+    }
+
+    size_t reused{0}; // Tokens kept by the last update()
+
+private:
+    static constexpr size_t NO_STEP = ~size_t{0};
+
+    // State after matching the tokens up to 'end'
+    struct Step {
+        size_t end;
+        size_t positionals;
+        size_t options;
+        size_t names; // Option family names
+        bool replaced;   // Replaced the value of a previous option
+        bool incomplete; // Ran out of tokens, eg. a short option value
+        Error error;
+    };
+
+    // Drops the tokens not entirely before 'prefix', with their separator
+    void truncate(size_t prefix) {
+        size_t k = 0;
+
+        while(k < items.size() && next[k] != NO_SEPARATOR && next[k] <= prefix)
+            ++k;
+
+        size_t s = 0;
+
+        while(s < steps.size() && steps[s].end <= k && !steps[s].incomplete)
+            ++s;
+
+        for(size_t i = s; i < steps.size(); i++) {
+            if(steps[i].replaced) {
+                k = 0;
+                s = 0;
+                break;
+            }
+        }
+
+        if(!k) {
+            s = 0;
+            scratch.clear();
+        }
+        else {
+            k = s ? steps[s - 1].end : 1;
+            scratch.positionals.resize(s ? steps[s - 1].positionals : 0);
+
+            size_t options = s ? steps[s - 1].options : 0;
+
+            for(size_t i = options; i < scratch.options.size(); i++)
+                scratch.given.unset(scratch.options[i].id);
+
+            scratch.options.resize(options);
+            scratch.names.resize(s ? steps[s - 1].names : 0);
+        }
+
+        if(firsterror != NO_STEP && firsterror >= s)
+            firsterror = NO_STEP;
+        if(terminator != NO_STEP && terminator >= k)
+            terminator = NO_STEP;
+
+        items.resize(k);
+        next.resize(k);
+        steps.resize(s);
+        tokenerror = Error{};
+        reused = k;
+    }
+
+    // Stops after a '--' token and returns true, scan() tells what it is
+    bool tokenize(size_t restart) {
+        char* b = buffer.data();
+        impl::LineTokens tokens{b + restart, b + buffer.size()};
+        tokens.index = static_cast<int>(items.size()) + 1;
+        impl::Token t;
+
+        while(tokens.next(t)) {
+            items.push_back(LineToken{static_cast<size_t>(t.val.data() - b),
+                                      static_cast<size_t>(tokens.last - b),
+                                      TokenKind::ARGUMENT, t.val});
+
+            next.push_back(tokens.p > tokens.last
+                               ? static_cast<size_t>(tokens.p - b)
+                               : NO_SEPARATOR);
+
+            if(t.val == impl::TERMINATOR)
+                return true;
+        }
+
+        tokenerror = tokens.error;
+        return false;
+    }
+
+    // The line after '--' as a single token, as written
+    void add_rest() {
+        size_t b = next[terminator];
+
+        if(b == NO_SEPARATOR)
+            return;
+
+        while(b < text.size() && impl::LineTokens::is_space(text[b]))
+            ++b;
+
+        if(b == text.size())
+            return;
+
+        items.push_back(LineToken{b, text.size(), TokenKind::ARGUMENT,
+                                  {buffer.data() + b, text.size() - b}});
+
+        next.push_back(NO_SEPARATOR);
+
+        const Step& last = steps.back();
+        steps.push_back(Step{items.size(), last.positionals, last.options,
+                             last.names, false, false, Error{}});
+    }
+
+    void scan() {
+        if(items.empty())
+            return;
+
+        if(steps.empty()) {
+            scratch.clear();
+            scratch.name = impl::Token{items[0].val, 1};
+            scratch.allowed = impl::named_options(items[0].val);
+            items[0].kind = TokenKind::COMMAND;
+        }
+
+        size_t first = steps.empty() ? 1 : steps.back().end;
+        impl::VectorTokens tokens{items, static_cast<int>(first) + 1,
+                                  tokenerror};
+        impl::Token t;
+
+        while(tokens.next(t)) {
+            size_t i = static_cast<size_t>(t.index - 1);
+            size_t positionals = scratch.positionals.size();
+            size_t options = scratch.options.size();
+
+            // The rest of the line is passed through, see add_rest()
+            if(t.val == impl::TERMINATOR) {
+                terminator = i;
+                items[i].kind = TokenKind::OPTION;
+
+                steps.push_back(Step{i + 1, positionals, options,
+                                     scratch.names.size(), false, false,
+                                     Error{}});
+                break;
+            }
+
+            Error err = impl::match_token(tokens, t, scratch);
+            auto end = static_cast<size_t>(tokens.index - 1);
+            bool positional = scratch.positionals.size() > positionals;
+
+            items[i].kind =
+                positional ? TokenKind::ARGUMENT : TokenKind::OPTION;
+
+            for(size_t j = i + 1; j < end; j++)
+                items[j].kind = TokenKind::VALUE;
+
+            bool replaced = err.code == ErrorCode::NONE && !positional &&
+                            scratch.options.size() == options;
+
+            bool incomplete =
+                err.code == ErrorCode::INVALID_SHORT_OPTION_FORMAT ||
+                err.code == ErrorCode::INVALID_QUOTING;
+
+            if(err.code != ErrorCode::NONE && firsterror == NO_STEP)
+                firsterror = steps.size();
+
+            steps.push_back(Step{end, scratch.positionals.size(),
+                                 scratch.options.size(), scratch.names.size(),
+                                 replaced, incomplete, err});
+        }
+    }
+
+    std::string text;   // As written
+    std::string buffer; // Unescaped in place, tokens refer to it
+    std::vector<LineToken> items;
+    std::vector<size_t> next; // Offset after each token separator
+    std::vector<Step> steps;
+    size_t firsterror{NO_STEP};
+    size_t terminator{NO_STEP}; // Index of the '--' token
+    impl::Scratch scratch;
+    Error tokenerror;
+    Error result;
+    uint64_t grammar{0};
+};
+
+} // namespace cl
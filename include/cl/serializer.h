@@ -0,0 +1,360 @@
+/*
+ *  _____  _
+ * /  __ \| |      Easy command line parsing with EDSL
+ * | /  \/| |      Streaming serialization of parsed arguments
+ * | |    | |
+ * | \__/\| |____  https://github.com/Dax89/cl
+ *  \____/\_____/
+ *
+ * License: MIT
+ * https://github.com/Dax89/cl/blob/master/LICENSE
+ */
+
+#pragma once
+
+#include <charconv>
+#include <cl/cl.h>
+#include <cstring>
+
+namespace cl {
+
+enum class Format {
+    JSON,
+    JSON_LINES, // JSON followed by a newline
+    BINARY,
+};
+
+/*
+ * Writes to a caller buffer, the required size is tracked even when it
+ * overflows so the caller can retry with a bigger one.
+ */
+struct BufferSink {
+    BufferSink(char* d, size_t c): data{d}, capacity{c} {}
+
+    void write(const char* s, size_t n) {
+        if(size + n <= capacity)
+            std::memcpy(data + size, s, n);
+
+        size += n;
+    }
+
+    [[nodiscard]] bool overflow() const { return size > capacity; }
+
+    char* data;
+    size_t capacity;
+    size_t size{0};
+};
+
+struct FileSink {
+    explicit FileSink(std::FILE* f): file{f} {}
+
+    void write(const char* s, size_t n) { std::fwrite(s, 1, n, file); }
+
+    std::FILE* file;
+};
+
+namespace impl {
+
+constexpr std::string_view HEX_DIGITS = "0123456789abcdef";
+
+template<typename Sink>
+void write(Sink& sink, std::string_view v) {
+    sink.write(v.data(), v.size());
+}
+
+template<typename Sink>
+void write_json_string(Sink& sink, std::string_view v) {
+    impl::write(sink, "\"");
+
+    size_t b = 0;
+
+    for(size_t i = 0; i < v.size(); i++) {
+        auto ch = static_cast<unsigned char>(v[i]);
+
+        if(ch >= 0x20 && ch != '"' && ch != '\\')
+            continue;
+
+        impl::write(sink, v.substr(b, i - b)); // Flush the plain run
+        b = i + 1;
+
+        switch(ch) {
+            case '"': impl::write(sink, "\\\""); break;
+            case '\\': impl::write(sink, "\\\\"); break;
+            case '\n': impl::write(sink, "\\n"); break;
+            case '\r': impl::write(sink, "\\r"); break;
+            case '\t': impl::write(sink, "\\t"); break;
+
+            default: {
+                char esc[] = {'\\', 'u', '0', '0', HEX_DIGITS[ch >> 4],
+                              HEX_DIGITS[ch & 0xF]};
+                sink.write(esc, sizeof(esc));
+                break;
+            }
+        }
+    }
+
+    impl::write(sink, v.substr(b));
+    impl::write(sink, "\"");
+}
+
+template<typename Sink>
+void write_json(Sink& sink, const Arg& arg) {
+    std::visit(
+        [&](auto& x) {
+            using T = std::decay_t<decltype(x)>;
+
+            if constexpr(std::is_same_v<T, bool>)
+                impl::write(sink, x ? "true" : "false");
+            else if constexpr(std::is_same_v<T, int>) {
+                char buf[16];
+                auto [p, _] = std::to_chars(buf, buf + sizeof(buf), x);
+                sink.write(buf, static_cast<size_t>(p - buf));
+            }
+            else if constexpr(std::is_same_v<T, std::string_view>)
+                impl::write_json_string(sink, x);
+            else if constexpr(std::is_same_v<T, std::monostate>)
+                impl::write(sink, "null");
+            else
+                static_assert(Arg::always_false_v<T>);
+        },
+        arg.v);
+}
+
+// LEB128
+template<typename Sink>
+void write_varint(Sink& sink, uint64_t v) {
+    char buf[10];
+    size_t n = 0;
+
+    do {
+        auto b = static_cast<unsigned char>(v & 0x7F);
+        v >>= 7;
+        buf[n++] = static_cast<char>(v ? b | 0x80 : b);
+    } while(v);
+
+    sink.write(buf, n);
+}
+
+/*
+ * Binary format, all integers are varints:
+ *   count, then for each argument: key size, key, tag, value
+ * where value is: nothing (null), one byte (bool), zigzag integer (int),
+ * size and bytes (string). Tags match SnapshotSlot.
+ */
+template<typename Sink>
+void write_binary(Sink& sink, std::string_view key, const Arg& arg) {
+    impl::write_varint(sink, key.size());
+    impl::write(sink, key);
+
+    std::visit(
+        [&](auto& x) {
+            using T = std::decay_t<decltype(x)>;
+
+            if constexpr(std::is_same_v<T, bool>) {
+                char v[] = {1, x};
+                sink.write(v, sizeof(v));
+            }
+            else if constexpr(std::is_same_v<T, int>) {
+                impl::write(sink, {"\2", 1});
+                auto z = static_cast<uint32_t>(x);
+                impl::write_varint(sink, (z << 1) ^ (x < 0 ? ~0U : 0U));
+            }
+            else if constexpr(std::is_same_v<T, std::string_view>) {
+                impl::write(sink, {"\3", 1});
+                impl::write_varint(sink, x.size());
+                impl::write(sink, x);
+            }
+            else if constexpr(std::is_same_v<T, std::monostate>)
+                impl::write(sink, {"\0", 1});
+            else
+                static_assert(Arg::always_false_v<T>);
+        },
+        arg.v);
+}
+
+/*
+ * Calls 'fn(name, enabled)' for each name of the family 'f' given in
+ * 'args': declared names in declaration order, then open ones in command
+ * line order, the last occurrence of each.
+ */
+template<typename Function>
+void for_each_name(const Args& args, const FamilyTable& f, Function&& fn) {
+    const auto& names = *Options::items[f.option].family;
+
+    for(size_t bit = 0; bit < names.size(); bit++) {
+        size_t w = f.offset + (bit >> 6);
+        uint64_t mask = uint64_t{1} << (bit & 63);
+
+        if(w + f.words < args.flags.size() && (args.flags[w] & mask))
+            fn(names[bit], (args.flags[w + f.words] & mask) != 0);
+    }
+
+    const auto& others = args.others;
+
+    for(size_t i = 0; i < others.size(); i++) {
+        if(others[i].slot != f.slot)
+            continue;
+
+        bool last = std::none_of(
+            others.begin() + static_cast<std::ptrdiff_t>(i) + 1, others.end(),
+            [&](const FamilyName& n) {
+                return n.slot == f.slot && n.name == others[i].name;
+            });
+
+        if(last)
+            fn(others[i].name, others[i].enabled);
+    }
+}
+
+/*
+ * Option family names, after the arguments. JSON: one member per family
+ * given, keyed by its dashed prefix ("-f": {"pic": true, "lto": false}),
+ * 'first' tells if it is the first member, the result if it still is.
+ * Binary: count, then for each name: prefix size, prefix, name size,
+ * name, enabled byte.
+ */
+template<typename Sink>
+bool write_families(Sink& sink, const Args& args, Format fmt, bool first) {
+    if(fmt == Format::BINARY) {
+        size_t count = 0;
+
+        for(const FamilyTable& f : layout.families)
+            impl::for_each_name(args, f, [&count](auto&&...) { ++count; });
+
+        impl::write_varint(sink, count);
+    }
+
+    for(const FamilyTable& f : layout.families) {
+        bool empty = true;
+
+        impl::for_each_name(args, f, [&](std::string_view name, bool enabled) {
+            if(fmt == Format::BINARY) {
+                impl::write_varint(sink, f.prefix.size());
+                impl::write(sink, f.prefix);
+                impl::write_varint(sink, name.size());
+                impl::write(sink, name);
+                impl::write(sink, {enabled ? "\1" : "\0", 1});
+                return;
+            }
+
+            if(empty) {
+                impl::write(sink, first ? "" : ",");
+                impl::write_json_string(sink, "-" + std::string{f.prefix});
+                impl::write(sink, ":{");
+            }
+            else
+                impl::write(sink, ",");
+
+            empty = false;
+            impl::write_json_string(sink, name);
+            impl::write(sink, enabled ? ":true" : ":false");
+        });
+
+        if(!empty && fmt != Format::BINARY) {
+            impl::write(sink, "}");
+            first = false;
+        }
+    }
+
+    return first;
+}
+
+/*
+ * Arguments after '--', last. JSON: "--" followed by an array of the
+ * arguments from argv or by the rest of a line as written, omitted if
+ * empty. Binary: count and arguments from argv, then the rest of a line.
+ */
+template<typename Sink>
+void write_rest(Sink& sink, const Rest& rest, Format fmt, bool first) {
+    if(fmt == Format::BINARY) {
+        impl::write_varint(sink, rest.size());
+
+        for(std::string_view arg : rest) {
+            impl::write_varint(sink, arg.size());
+            impl::write(sink, arg);
+        }
+
+        impl::write_varint(sink, rest.line.size());
+
+        if(!rest.line.empty())
+            impl::write(sink, rest.line);
+
+        return;
+    }
+
+    if(rest.empty())
+        return;
+
+    impl::write(sink, first ? "\"--\":" : ",\"--\":");
+
+    if(!rest.argc) {
+        impl::write_json_string(sink, rest.line);
+        return;
+    }
+
+    for(size_t i = 0; i < rest.size(); i++) {
+        impl::write(sink, i ? "," : "[");
+        impl::write_json_string(sink, rest[i]);
+    }
+
+    impl::write(sink, "]");
+}
+
+} // namespace impl
+
+/*
+ * Writes every argument to 'sink' in grammar order, then the option
+ * family names given and the arguments after '--' (see
+ * impl::write_families() and impl::write_rest()), in a single pass.
+ */
+template<typename Sink>
+void serialize(const Args& args, Sink& sink, Format fmt = Format::JSON) {
+    if(fmt == Format::BINARY)
+        impl::write_varint(sink, args.size());
+    else
+        impl::write(sink, "{");
+
+    bool first = true;
+
+    for(const auto& [key, arg] : args) {
+        if(fmt == Format::BINARY) {
+            impl::write_binary(sink, key, arg);
+            continue;
+        }
+
+        if(!first)
+            impl::write(sink, ",");
+
+        first = false;
+        impl::write_json_string(sink, key);
+        impl::write(sink, ":");
+        impl::write_json(sink, arg);
+    }
+
+    first = impl::write_families(sink, args, fmt, first);
+    impl::write_rest(sink, args.rest, fmt, first);
+
+    if(fmt == Format::JSON)
+        impl::write(sink, "}");
+    else if(fmt == Format::JSON_LINES)
+        impl::write(sink, "}\n");
+}
+
+/*
+ * Serializes to a caller buffer and returns the number of bytes needed:
+ * if it is greater than 'capacity' the output has been truncated.
+ */
+inline size_t serialize(const Args& args, char* buffer, size_t capacity,
+                        Format fmt = Format::JSON) {
+    BufferSink sink{buffer, capacity};
+    cl::serialize(args, sink, fmt);
+    return sink.size;
+}
+
+inline void serialize(const Args& args, std::FILE* f,
+                      Format fmt = Format::JSON) {
+    FileSink sink{f};
+    cl::serialize(args, sink, fmt);
+}
+
+} // namespace cl
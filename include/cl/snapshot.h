@@ -0,0 +1,385 @@
+/*
+ *  _____  _
+ * /  __ \| |      Easy command line parsing with EDSL
+ * | /  \/| |      Compact snapshots of parsed arguments
+ * | |    | |
+ * | \__/\| |____  https://github.com/Dax89/cl
+ *  \____/\_____/
+ *
+ * License: MIT
+ * https://github.com/Dax89/cl/blob/master/LICENSE
+ */
+
+#pragma once
+
+#include <cl/cl.h>
+#include <cstring>
+#include <limits>
+
+namespace cl {
+
+/*
+ * A snapshot is a single relocatable block of bytes, every offset is
+ * relative to its beginning so it can be copied anywhere with memcpy:
+ *
+ *   SnapshotHeader | SnapshotSlot[count] | uint64_t[flags] |
+ *   SnapshotName[names] | SnapshotSlot[rest] | string pool
+ *
+ * Slots are indexed by the grammar slot id (see impl::Layout), flags and
+ * names are Args::flags and Args::others. The rest slots are the strings
+ * after '--': the arguments from argv, or the rest of a line if 'line'.
+ */
+struct SnapshotHeader {
+    uint32_t size;    // Whole block, in bytes
+    uint32_t count;   // Number of slots
+    uint64_t grammar; // Fingerprint of the grammar that produced it
+    uint32_t flags;   // Number of words of option family bits
+    uint32_t names;   // Number of open option family names
+    uint32_t rest;    // Number of rest slots
+    uint32_t line;    // 1 if the rest is a line as written, in one slot
+};
+
+struct SnapshotSlot {
+    static constexpr uint32_t NULL_TAG = 0;
+    static constexpr uint32_t BOOL_TAG = 1;
+    static constexpr uint32_t INT_TAG = 2;
+    static constexpr uint32_t STRING_TAG = 3;
+    static constexpr uint32_t TAG_SHIFT = 30;
+    static constexpr uint32_t SIZE_MASK = (1U << TAG_SHIFT) - 1;
+
+    uint32_t value;   // bool, int or string pool offset
+    uint32_t tagsize; // Tag in the upper bits, string size in the lower ones
+};
+
+// A name of an open option family, see FamilyName
+struct SnapshotName {
+    uint32_t slot;    // Family option id
+    uint32_t enabled; // 0 or 1
+    uint32_t offset;  // String pool offset
+    uint32_t size;
+};
+
+static_assert(sizeof(SnapshotHeader) == 32);
+static_assert(sizeof(SnapshotSlot) == 8);
+static_assert(sizeof(SnapshotName) == 16);
+static_assert(std::is_trivially_copyable_v<SnapshotHeader>);
+static_assert(std::is_trivially_copyable_v<SnapshotSlot>);
+static_assert(std::is_trivially_copyable_v<SnapshotName>);
+
+namespace impl {
+
+// Offsets of the sections following the slots
+struct SnapshotSections {
+    explicit SnapshotSections(const SnapshotHeader& h)
+        : flags{sizeof(SnapshotHeader) + h.count * sizeof(SnapshotSlot)},
+          names{flags + h.flags * sizeof(uint64_t)},
+          rest{names + h.names * sizeof(SnapshotName)},
+          pool{rest + h.rest * sizeof(SnapshotSlot)} {}
+
+    size_t flags;
+    size_t names;
+    size_t rest;
+    size_t pool;
+};
+
+} // namespace impl
+
+/*
+ * Read-only access to a snapshot stored in at most 'capacity' bytes (eg.
+ * a ring buffer slot), it does not need any alignment.
+ */
+struct SnapshotView {
+    SnapshotView(const void* d, size_t n)
+        : data{static_cast<const char*>(d)}, capacity{n} {}
+
+    // Zeroed if the block cannot hold one
+    [[nodiscard]] SnapshotHeader header() const {
+        SnapshotHeader h{};
+
+        if(capacity >= sizeof(h))
+            std::memcpy(&h, data, sizeof(h));
+
+        return h;
+    }
+
+    [[nodiscard]] size_t size() const { return this->header().size; }
+    [[nodiscard]] size_t count() const { return this->header().count; }
+
+    // True if it fits the block and has been taken with the current grammar
+    [[nodiscard]] bool valid() const {
+        if(capacity < sizeof(SnapshotHeader))
+            return false;
+
+        SnapshotHeader h = this->header();
+        impl::SnapshotSections at{h};
+
+        return h.size <= capacity && at.pool <= h.size &&
+               h.grammar == impl::layout.fingerprint &&
+               h.count == impl::layout.names.size() &&
+               h.flags == impl::layout.flagwords;
+    }
+
+    [[nodiscard]] Arg operator[](size_t slot) const {
+        return this->read(sizeof(SnapshotHeader) + slot * sizeof(SnapshotSlot));
+    }
+
+    // Null if the snapshot is not valid()
+    [[nodiscard]] Arg operator[](const Handle& h) const {
+        uint32_t slot = h.get();
+
+        if(!this->valid() || slot >= this->count())
+            return Arg{};
+
+        return this->operator[](slot);
+    }
+
+    [[nodiscard]] Arg operator[](const Key& key) const {
+        uint32_t slot = impl::layout.index.find(key);
+
+        if(!this->valid() || slot >= this->count())
+            return Arg{};
+
+        return this->operator[](slot);
+    }
+
+    // String values refer to the snapshot, empty if it is not valid()
+    [[nodiscard]] Args to_args() const {
+        if(!this->valid())
+            return Args{};
+
+        // Lazy defaults were computed when it was taken, if at all
+        Args args = impl::init_value(impl::Bitset{});
+        size_t n = std::min(this->count(), args.size());
+
+        for(size_t i = 0; i < n; i++)
+            args.values[i] = this->operator[](i);
+
+        SnapshotHeader h = this->header();
+        impl::SnapshotSections at{h};
+
+        if(!args.flags.empty()) {
+            std::memcpy(args.flags.data(), data + at.flags,
+                        args.flags.size() * sizeof(uint64_t));
+        }
+
+        for(size_t i = 0; i < h.names; i++) {
+            SnapshotName n{};
+            std::memcpy(&n, data + at.names + i * sizeof(n), sizeof(n));
+
+            if(n.offset + size_t{n.size} > capacity)
+                continue;
+
+            std::string_view name{data + n.offset, n.size};
+            args.others.push_back(FamilyName{n.slot, name, n.enabled != 0});
+        }
+
+        // Arguments from argv are only available with rest(), see Rest
+        if(h.line && h.rest)
+            args.rest.line = this->rest(0);
+
+        return args;
+    }
+
+    // Number of strings after '--', see SnapshotHeader::line
+    [[nodiscard]] size_t rest_size() const {
+        return this->valid() ? this->header().rest : 0;
+    }
+
+    [[nodiscard]] std::string_view rest(size_t i) const {
+        if(i >= this->rest_size())
+            return {};
+
+        impl::SnapshotSections at{this->header()};
+        Arg arg = this->read(at.rest + i * sizeof(SnapshotSlot));
+        return arg.is_string() ? arg.to_stringview() : std::string_view{};
+    }
+
+    const char* data;
+    size_t capacity;
+
+private:
+    // The value of the SnapshotSlot at 'offset'
+    [[nodiscard]] Arg read(size_t offset) const {
+        SnapshotSlot s{};
+        std::memcpy(&s, data + offset, sizeof(s));
+
+        switch(s.tagsize >> SnapshotSlot::TAG_SHIFT) {
+            case SnapshotSlot::BOOL_TAG: return Arg{s.value != 0};
+            case SnapshotSlot::INT_TAG: return Arg{static_cast<int>(s.value)};
+
+            case SnapshotSlot::STRING_TAG: {
+                size_t n = s.tagsize & SnapshotSlot::SIZE_MASK;
+
+                if(s.value + n > capacity)
+                    break;
+
+                return Arg{std::string_view{data + s.value, n}};
+            }
+
+            default: break;
+        }
+
+        return Arg{};
+    }
+};
+
+// Owning snapshot
+struct Snapshot {
+    [[nodiscard]] SnapshotView view() const {
+        return SnapshotView{data.data(), data.size()};
+    }
+
+    std::vector<char> data;
+};
+
+namespace impl {
+
+constexpr size_t SNAPSHOT_ALIGNMENT = 8;
+
+// Strings after '--': the arguments from argv or the rest of a line
+inline size_t rest_count(const Rest& rest) {
+    return rest.argc ? rest.size() : !rest.line.empty();
+}
+
+inline std::string_view rest_at(const Rest& rest, size_t i) {
+    return rest.argc ? rest[i] : rest.line;
+}
+
+// Sizes and offsets are 32 bit, strings are at most SIZE_MASK bytes
+inline bool fits_snapshot(const Args& args, size_t size) {
+    if(size > std::numeric_limits<uint32_t>::max())
+        return false;
+
+    for(const auto& [k, a] : args) {
+        if(a.is_string() && a.to_stringview().size() > SnapshotSlot::SIZE_MASK)
+            return false;
+    }
+
+    for(size_t i = 0; i < impl::rest_count(args.rest); i++) {
+        if(impl::rest_at(args.rest, i).size() > SnapshotSlot::SIZE_MASK)
+            return false;
+    }
+
+    return args.flags.size() == layout.flagwords;
+}
+
+} // namespace impl
+
+// Number of bytes needed by write_snapshot()
+inline size_t snapshot_size(const Args& args) {
+    size_t size = sizeof(SnapshotHeader) +
+                  args.size() * sizeof(SnapshotSlot) +
+                  args.flags.size() * sizeof(uint64_t) +
+                  args.others.size() * sizeof(SnapshotName) +
+                  impl::rest_count(args.rest) * sizeof(SnapshotSlot);
+
+    for(const auto& [k, a] : args) {
+        if(a.is_string())
+            size += a.to_stringview().size();
+    }
+
+    for(const FamilyName& n : args.others)
+        size += n.name.size();
+
+    for(size_t i = 0; i < impl::rest_count(args.rest); i++)
+        size += impl::rest_at(args.rest, i).size();
+
+    return (size + impl::SNAPSHOT_ALIGNMENT - 1) &
+           ~(impl::SNAPSHOT_ALIGNMENT - 1);
+}
+
+/*
+ * Writes a snapshot of 'args' to 'dst' (eg. a ring buffer slot) and
+ * returns its size, nothing is written if 'capacity' is not enough or
+ * a value is too large to be stored.
+ */
+inline size_t write_snapshot(const Args& args, void* dst, size_t capacity) {
+    size_t size = cl::snapshot_size(args);
+
+    if(size > capacity || !impl::fits_snapshot(args, size))
+        return 0;
+
+    auto* out = static_cast<char*>(dst);
+    auto n = static_cast<uint32_t>(args.size());
+    SnapshotHeader h{static_cast<uint32_t>(size), n, impl::layout.fingerprint,
+                     static_cast<uint32_t>(args.flags.size()),
+                     static_cast<uint32_t>(args.others.size()),
+                     static_cast<uint32_t>(impl::rest_count(args.rest)),
+                     args.rest.argc || args.rest.line.empty() ? 0U : 1U};
+    std::memcpy(out, &h, sizeof(h));
+
+    impl::SnapshotSections at{h};
+    size_t pool = at.pool;
+
+    for(size_t i = 0; i < n; i++) {
+        SnapshotSlot s{0, SnapshotSlot::NULL_TAG};
+
+        std::visit(
+            [&](auto& x) {
+                using T = std::decay_t<decltype(x)>;
+                constexpr uint32_t SHIFT = SnapshotSlot::TAG_SHIFT;
+
+                if constexpr(std::is_same_v<T, bool>)
+                    s = {x, SnapshotSlot::BOOL_TAG << SHIFT};
+                else if constexpr(std::is_same_v<T, int>) {
+                    s = {static_cast<uint32_t>(x),
+                         SnapshotSlot::INT_TAG << SHIFT};
+                }
+                else if constexpr(std::is_same_v<T, std::string_view>) {
+                    std::memcpy(out + pool, x.data(), x.size());
+
+                    s = {static_cast<uint32_t>(pool),
+                         (SnapshotSlot::STRING_TAG << SHIFT) |
+                             static_cast<uint32_t>(x.size())};
+
+                    pool += x.size();
+                }
+            },
+            args[i].v);
+
+        std::memcpy(out + sizeof(SnapshotHeader) + i * sizeof(SnapshotSlot),
+                    &s, sizeof(s));
+    }
+
+    if(!args.flags.empty()) {
+        std::memcpy(out + at.flags, args.flags.data(),
+                    args.flags.size() * sizeof(uint64_t));
+    }
+
+    for(size_t i = 0; i < args.others.size(); i++) {
+        const FamilyName& f = args.others[i];
+        std::memcpy(out + pool, f.name.data(), f.name.size());
+
+        SnapshotName name{f.slot, f.enabled, static_cast<uint32_t>(pool),
+                          static_cast<uint32_t>(f.name.size())};
+        std::memcpy(out + at.names + i * sizeof(name), &name, sizeof(name));
+        pool += f.name.size();
+    }
+
+    for(size_t i = 0; i < h.rest; i++) {
+        std::string_view arg = impl::rest_at(args.rest, i);
+        std::memcpy(out + pool, arg.data(), arg.size());
+
+        SnapshotSlot s{static_cast<uint32_t>(pool),
+                       (SnapshotSlot::STRING_TAG << SnapshotSlot::TAG_SHIFT) |
+                           static_cast<uint32_t>(arg.size())};
+        std::memcpy(out + at.rest + i * sizeof(s), &s, sizeof(s));
+        pool += arg.size();
+    }
+
+    std::memset(out + pool, 0, size - pool);
+    return size;
+}
+
+// Empty if a value is too large to be stored
+inline Snapshot snapshot(const Args& args) {
+    Snapshot s;
+    s.data.resize(cl::snapshot_size(args));
+
+    if(!cl::write_snapshot(args, s.data.data(), s.data.size()))
+        s.data.clear();
+
+    return s;
+}
+
+} // namespace cl
@@ -0,0 +1,204 @@
+/*
+ *  _____  _
+ * /  __ \| |      Easy command line parsing with EDSL
+ * | /  \/| |      Validation of long argument lists on a thread pool
+ * | |    | |
+ * | \__/\| |____  https://github.com/Dax89/cl
+ *  \____/\_____/
+ *
+ * License: MIT
+ * https://github.com/Dax89/cl/blob/master/LICENSE
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cl/parallel.h>
+#include <exception>
+#include <iterator>
+
+namespace cl {
+
+// A value rejected by its Validator
+struct ValidationFailure {
+    int index;              // Token index, argv[index]
+    std::string_view token; // Refers to the parsed command line
+    std::string reason;
+};
+
+// Every rejected value of a command line, sorted by index
+struct ValidationReport {
+    [[nodiscard]] bool empty() const { return failures.empty(); }
+
+    // One line per failure
+    [[nodiscard]] std::string message() const {
+        std::string res;
+
+        for(const ValidationFailure& f : failures) {
+            res += impl::concat("Invalid value '", f.token, "': ", f.reason,
+                                "\n");
+        }
+
+        return res;
+    }
+
+    std::vector<ValidationFailure> failures;
+};
+
+/*
+ * Parses like cl::try_parse() but checks every value instead of stopping
+ * at the first rejected one. When a command line has at least
+ * 'threshold' checked values they are split in chunks and checked on a
+ * Dispatcher, validators must be thread safe.
+ * The grammar is finalized on construction and must not change while
+ * the parser is alive.
+ */
+struct ValidatingParser {
+    static constexpr size_t DEFAULT_THRESHOLD = 256;
+    static constexpr size_t CHUNKS_PER_THREAD = 4;
+
+    explicit ValidatingParser(
+        size_t threads = std::thread::hardware_concurrency(),
+        size_t minchecks = DEFAULT_THRESHOLD)
+        : dispatcher{threads}, concurrency{threads ? threads : 1},
+          threshold{minchecks} {}
+
+    // On failure the error is the first rejected value
+    Result<Args> try_parse(int argc, char** argv, ValidationReport& report) {
+        impl::ArgvTokens tokens{argc, argv};
+        return this->parse_tokens(tokens, report);
+    }
+
+    // The buffer is unescaped in place: returned Args refer to it
+    Result<Args> try_parse(std::string& line, ValidationReport& report) {
+        impl::LineTokens tokens{line.data(), line.data() + line.size()};
+        return this->parse_tokens(tokens, report);
+    }
+
+    // Prints every rejected value and exits
+    Args parse(int argc, char** argv) {
+        ValidationReport report;
+        Result<Args> res = this->try_parse(argc, argv, report);
+
+        if(res)
+            return std::move(*res);
+
+        if(report.empty())
+            impl::fail(res.error());
+
+        for(const ValidationFailure& f : report.failures) {
+            std::string msg = impl::concat("ERROR: Invalid value '", f.token,
+                                           "': ", f.reason, "\n");
+            std::fputs(msg.c_str(), stdout);
+        }
+
+        std::exit(2);
+    }
+
+private:
+    struct Check {
+        const Validator* validator;
+        impl::Token token;
+    };
+
+    template<typename Tokens>
+    Result<Args> parse_tokens(Tokens& tokens, ValidationReport& report) {
+        report.failures.clear();
+
+        impl::Scratch scratch;
+        Error err = impl::match(tokens, scratch);
+
+        if(err.code != ErrorCode::NONE)
+            return err;
+
+        checks.clear();
+
+        impl::for_each_checked(
+            scratch, [this](const Validator& v, const impl::Token& t) {
+                checks.push_back(Check{&v, t});
+            });
+
+        if(checks.size() < threshold)
+            this->run(0, checks.size(), report.failures);
+        else
+            this->run_parallel(report.failures);
+
+        // Positionals are checked before options
+        std::stable_sort(report.failures.begin(), report.failures.end(),
+                         [](const ValidationFailure& a,
+                            const ValidationFailure& b) {
+                             return a.index < b.index;
+                         });
+
+        if(!report.empty()) {
+            const ValidationFailure& f = report.failures.front();
+            Error e{ErrorCode::INVALID_VALUE, f.index, f.token};
+            e.reason = f.reason;
+            return e;
+        }
+
+        Args args = impl::to_args(scratch);
+        impl::dispatch(scratch, args);
+        return args;
+    }
+
+    void run(size_t b, size_t e, std::vector<ValidationFailure>& res) const {
+        for(size_t i = b; i < e; i++) {
+            const Check& c = checks[i];
+            std::string reason = (*c.validator)(c.token.val);
+
+            if(!reason.empty()) {
+                res.push_back(ValidationFailure{c.token.index, c.token.val,
+                                                std::move(reason)});
+            }
+        }
+    }
+
+    // Chunks are merged in order, as if checked serially. The first
+    // exception thrown by a validator is rethrown here
+    void run_parallel(std::vector<ValidationFailure>& res) {
+        size_t n = std::min(checks.size(), concurrency * CHUNKS_PER_THREAD);
+        std::vector<std::vector<ValidationFailure>> chunks(n);
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+        size_t remaining = n;
+
+        for(size_t i = 0; i < n; i++) {
+            dispatcher.post([&, i]() {
+                std::exception_ptr e;
+
+                try {
+                    this->run(checks.size() * i / n,
+                              checks.size() * (i + 1) / n, chunks[i]);
+                }
+                catch(...) {
+                    e = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock{mutex};
+
+                if(e && !error)
+                    error = e;
+                if(!--remaining)
+                    done.notify_one();
+            });
+        }
+
+        std::unique_lock<std::mutex> lock{mutex};
+        done.wait(lock, [&remaining]() { return !remaining; });
+
+        if(error)
+            std::rethrow_exception(error);
+
+        for(auto& chunk : chunks)
+            std::move(chunk.begin(), chunk.end(), std::back_inserter(res));
+    }
+
+    Dispatcher dispatcher;
+    std::vector<Check> checks;
+    size_t concurrency;
+    size_t threshold;
+};
+
+} // namespace cl
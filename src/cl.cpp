@@ -0,0 +1,7 @@
+/*
+ * Compiled-library mode: defines the entry points declared in cl_fwd.h,
+ * translation units using cl must be built with CL_COMPILED too.
+ */
+
+#define CL_IMPLEMENTATION
+#include <cl/cl.h>
@@ -1,6 +1,25 @@
 #include <catch2/catch_test_macros.hpp>
+#include <cl/bind.h>
+#include <cl/cache.h>
+#include <cl/complete.h>
 #include <cl/cl.h>
+#include <cl/parallel.h>
+#include <cl/parser.h>
+#include <cl/repl.h>
+#include <cl/serializer.h>
+#include <cl/snapshot.h>
+#include <cl/validate.h>
+#include <algorithm>
 #include <iostream>
+#include <list>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace cl::string_literals;
 
@@ -9,6 +28,7 @@ void clear_cl() {
     cl::Options::valid.clear();
     cl::Usage::items.clear();
     cl::Usage::commands.clear();
+    cl::Rules::items.clear();
 }
 
 template<typename... Ts>
@@ -17,6 +37,25 @@ cl::Args parse_os(Ts&&... args) {
     return cl::parse(arr.size(), const_cast<char**>(arr.begin()));
 }
 
+#if !defined(_WIN32)
+// Runs 'fn' in a child process without output, returns its exit code
+template<typename Function>
+int exit_code(Function&& fn) {
+    std::fflush(stdout);
+    pid_t pid = fork();
+
+    if(!pid) {
+        std::freopen("/dev/null", "w", stdout);
+        fn();
+        std::_Exit(0);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+#endif
+
 TEST_CASE("Positionals", "[positional]") {
     clear_cl();
     cl::help_on_exit = false;
@@ -206,3 +245,1910 @@ TEST_CASE("Any", "[any]") {
     REQUIRE(args["command5"] == "custom2");
     REQUIRE_FALSE(args["arg4_1"]);
 }
+
+TEST_CASE("Any matching", "[any]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    cl::Options{
+        cl::opt("fo", "force", "Force"),
+    };
+
+    cl::Usage{
+        cl::cmd("fetch"_a, cl::one("http", "ftp"), "url"),
+        cl::cmd("remove"_a, cl::one("file", "dir"), "path", --"force"_p),
+        cl::cmd("run"_a, "script"),
+        cl::cmd("list", *"filter"_p),
+    };
+
+    // Every any-command is evaluated, the surviving one is picked
+    std::string line = "get ftp example.org";
+    cl::Args args = cl::parse(line);
+    REQUIRE(args["fetch"] == "get");
+    REQUIRE(args["url"] == "example.org");
+
+    line = "rm dir /tmp --force";
+    args = cl::parse(line);
+    REQUIRE(args["remove"] == "rm");
+    REQUIRE(args["path"] == "/tmp");
+
+    line = "exec script.sh";
+    args = cl::parse(line);
+    REQUIRE(args["run"] == "exec");
+    REQUIRE(args["script"] == "script.sh");
+
+    // Named commands are never matched as any-commands
+    line = "list a";
+    args = cl::parse(line);
+    REQUIRE(args["list"] == "list");
+    REQUIRE(args["run"] == false);
+    REQUIRE(args["filter"] == "a");
+
+    // The failure of the candidate going further is reported
+    line = "get gopher example.org";
+    cl::Result<cl::Args> res = cl::try_parse(line);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_ARGUMENT);
+    REQUIRE(res.error().token == "gopher");
+
+    line = "rm dir /tmp";
+    res = cl::try_parse(line);
+    REQUIRE(res.error().code == cl::ErrorCode::MISSING_OPTION);
+
+    line = "get";
+    res = cl::try_parse(line);
+    REQUIRE(res.error().code == cl::ErrorCode::UNKNOWN_COMMAND);
+
+    // Overlapping any-commands, rejected by Usage with cl::reject_ambiguous
+    auto a = cl::cmd("a"_a, cl::one("x", "y"), *"p"_p);
+    auto b = cl::cmd("b"_a, cl::one("y", "z"));
+    auto c = cl::cmd("c"_a, cl::one("z"));
+    auto d = cl::cmd("d"_a, "q", "r");
+    auto e = cl::cmd("e"_a, "q", "r", --"force"_p);
+    auto f = cl::cmd("f"_a, "q", *"r"_p, *--"force"_p);
+    REQUIRE(cl::impl::overlaps(a, b));
+    REQUIRE(cl::impl::overlaps(a, d));
+    auto g = cl::cmd("g"_a, cl::one("a", "b"));
+    auto h = cl::cmd("h"_a, cl::one("c", "d"));
+    REQUIRE_FALSE(cl::impl::overlaps(a, c)); // Disjoint choices
+    REQUIRE_FALSE(cl::impl::overlaps(g, h));
+    REQUIRE_FALSE(cl::impl::overlaps(b, d));
+    REQUIRE_FALSE(cl::impl::overlaps(d, e)); // Required by one only
+    REQUIRE(cl::impl::overlaps(e, f));
+
+    // By default the first declared one wins
+    cl::Usage{
+        cl::cmd("pick"_a, cl::one("x", "y"), "p"),
+        cl::cmd("take"_a, cl::one("y"), "q"),
+    };
+
+    line = "get y z";
+    args = cl::parse(line);
+    REQUIRE(args["pick"] == "get");
+    REQUIRE(args["take"] == false);
+
+    // An empty value is not a choice where one is required
+    std::initializer_list<const char*> empty = {"", "get", "", "z"};
+    res = cl::try_parse(empty.size(), const_cast<char**>(empty.begin()));
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_ARGUMENT);
+}
+
+template<typename... Ts>
+cl::Result<cl::Args> try_parse_os(Ts&&... args) {
+    std::initializer_list<const char*> arr = {"", args...};
+    return cl::try_parse(arr.size(), const_cast<char**>(arr.begin()));
+}
+
+TEST_CASE("Errors", "[errors]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    // clang-format off
+    cl::Options{
+        cl::opt("o1", "option1", "Option 1"),
+        cl::opt("o2", "option2"_o, "Option 2"),
+    };
+
+    cl::Usage{
+        cl::cmd("command1", "arg1_1", *"arg1_2"_p, --"option1"_p),
+        cl::cmd("command2", cl::one("foo", "bar"), *--"option2"_p),
+        cl::cmd("command3"_a, "arg3_1"),
+    };
+    // clang-format oon
+
+    auto res = try_parse_os("command1", "one", "--option1");
+    REQUIRE(res);
+    REQUIRE((*res)["command1"] == "command1");
+    REQUIRE((*res)["arg1_1"] == "one");
+
+    res = try_parse_os();
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::HELP);
+
+    res = try_parse_os("--version");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::VERSION);
+
+    res = try_parse_os("command1", "one", "--option3");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_OPTION);
+    REQUIRE(res.error().index == 3);
+    REQUIRE(res.error().message() == "Invalid option '--option3'");
+
+    res = try_parse_os("command1", "--option1");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::MISSING_ARGUMENT);
+    REQUIRE(res.error().message() == "Missing required argument 'arg1_1'");
+
+    res = try_parse_os("command1", "one");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::MISSING_OPTION);
+    REQUIRE(res.error().token == "option1");
+
+    res = try_parse_os("command1", "one", "two", "three", "--option1");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::TOO_MANY_ARGUMENTS);
+    REQUIRE(res.error().index == 4);
+
+    res = try_parse_os("command2", "baz");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_ARGUMENT);
+    REQUIRE(res.error().index == 2);
+    REQUIRE(res.error().token == "baz");
+
+    res = try_parse_os("command2", "foo", "--option2");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_OPTION_FORMAT);
+
+    res = try_parse_os("command2", "foo", "-o2");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_SHORT_OPTION_FORMAT);
+
+    res = try_parse_os("custom");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::UNKNOWN_COMMAND);
+    REQUIRE(res.error().message() == "Unknown command 'custom'");
+}
+
+TEST_CASE("Signatures", "[errors]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    cl::Options{
+        cl::opt("o1", "option1", "Option 1"),
+        cl::opt("o2", "option2"_o, "Option 2"),
+    };
+
+    auto command1 = cl::cmd("command1", "arg1_1", *cl::one("foo", "bar"),
+                            --"o2"_p, *--"option1"_p);
+
+    cl::Usage{
+        command1,
+        cl::cmd("command2", *"arg2_1"_p),
+    };
+
+    std::string line = "command1 one bar -o2 x";
+    cl::Args args = cl::parse(line);
+    REQUIRE(args["bar"] == true);
+    REQUIRE(args["option2"] == "x");
+
+    const cl::impl::Signature& sig = cl::impl::layout.signatures[0];
+    REQUIRE(sig.minargs == 1);
+    REQUIRE(sig.maxargs == 2);
+    REQUIRE(sig.choices[0].empty());
+    REQUIRE(sig.choices[1].test(args.slot("foo")));
+    REQUIRE_FALSE(sig.choices[1].test(args.slot("arg1_1")));
+    REQUIRE(sig.allowed.test(cl::impl::find_option("option1")));
+    REQUIRE(sig.required.test(cl::impl::find_option("o2")));
+    REQUIRE_FALSE(sig.required.test(cl::impl::find_option("o1")));
+
+    // Options not declared for the command are rejected
+    line = "command2 one -o1";
+    cl::Result<cl::Args> res = cl::try_parse(line);
+    REQUIRE(res.error().code == cl::ErrorCode::UNEXPECTED_OPTION);
+    REQUIRE(res.error().index == 3);
+    REQUIRE(res.error().token == "-o1");
+
+    // Builtin options are accepted after any command
+    line = "command1 one --option2=x --help";
+    res = cl::try_parse(line);
+    REQUIRE(res);
+    REQUIRE((*res)["help"] == true);
+    REQUIRE((*res)["version"] == false);
+
+    line = "command1 one --option1";
+    res = cl::try_parse(line);
+    REQUIRE(res.error().code == cl::ErrorCode::MISSING_OPTION);
+    REQUIRE(res.error().token == "option2");
+
+    line = "command1 one baz -o2 x";
+    res = cl::try_parse(line);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_ARGUMENT);
+    REQUIRE(res.error().token == "baz");
+}
+
+TEST_CASE("Suggestions", "[errors]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    cl::Options{
+        cl::opt("o1", "option1", "Option 1"),
+        cl::opt("vb", "verbose", "Verbose"),
+        cl::opt("quiet", "q", "Quiet"),
+    };
+
+    cl::Usage{
+        cl::cmd("status", *--"verbose"_p),
+        cl::cmd("stash", cl::one("push", "pop", "list")),
+        cl::cmd("stage", cl::one("posh")),
+        cl::cmd("start"),
+        cl::cmd("any"_a, "arg", "arg2"),
+    };
+
+    cl::impl::Levenshtein lev{"kitten"};
+    REQUIRE(lev.distance("sitting") == 3);
+    REQUIRE(lev.distance("kitten") == 0);
+    REQUIRE(lev.distance("") == 6);
+    REQUIRE(cl::impl::Levenshtein{""}.distance("abc") == 3);
+
+    // Long patterns use the DP fallback, both must agree
+    std::string a(70, 'a'), b = a;
+    b[10] = 'b';
+    b.erase(40, 2);
+    REQUIRE(cl::impl::Levenshtein{a}.distance(b) == 3);
+    REQUIRE(cl::impl::Levenshtein{a.substr(0, 64)}.distance(
+                b.substr(0, 62)) == 3);
+
+    std::string line = "statsu";
+    cl::Result<cl::Args> res = cl::try_parse(line);
+    REQUIRE(res.error().code == cl::ErrorCode::UNKNOWN_COMMAND);
+    REQUIRE(cl::suggest(res.error()) ==
+            std::vector<std::string>{"status", "stash"});
+    REQUIRE(cl::suggest(res.error(), 1) == std::vector<std::string>{"status"});
+    REQUIRE(cl::impl::describe(res.error()) ==
+            "Unknown command 'statsu' (did you mean 'status', 'stash'?)");
+
+    line = "status --verbos";
+    res = cl::try_parse(line);
+    REQUIRE(cl::suggest(res.error()) == std::vector<std::string>{"--verbose"});
+
+    line = "status -o2";
+    res = cl::try_parse(line);
+    REQUIRE(cl::suggest(res.error()) ==
+            std::vector<std::string>{"-o1", "-vb"});
+
+    // Long names of 1 character are never matched, so not suggested
+    line = "status --r";
+    res = cl::try_parse(line);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_OPTION);
+    REQUIRE(cl::suggest(res.error()) ==
+            std::vector<std::string>{"-o1", "-vb"});
+
+    line = "status --quie";
+    res = cl::try_parse(line);
+    REQUIRE(cl::suggest(res.error()) == std::vector<std::string>{"-quiet"});
+
+    line = "stash psh";
+    res = cl::try_parse(line);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_ARGUMENT);
+    REQUIRE(cl::suggest(res.error()) ==
+            std::vector<std::string>{"push", "pop"}); // Not 'posh' of stage
+
+    line = "xyzzyplugh";
+    res = cl::try_parse(line);
+    REQUIRE(cl::suggest(res.error()).empty());
+
+    // Thousands of candidates
+    std::vector<std::string> names;
+
+    for(int i = 0; i < 5000; i++)
+        names.push_back("command" + std::to_string(i));
+
+    std::vector<std::string_view> found;
+    auto candidates = [&names](auto&& fn) {
+        for(const std::string& n : names)
+            fn(n);
+    };
+
+    cl::impl::nearest("comand4999", 2, candidates,
+                      [&found](std::string_view n) { found.push_back(n); });
+
+    REQUIRE(found.size() == 2);
+    REQUIRE(found[0] == "command4999");
+}
+
+TEST_CASE("Line", "[line]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    // clang-format off
+    cl::Options{
+        cl::opt("o1", "option1", "Option 1"),
+        cl::opt("o2", "option2"_o, "Option 2"),
+    };
+
+    cl::Usage{
+        cl::cmd("command1", "arg1_1", *"arg1_2"_p, *--"option1"_p, *--"option2"_p),
+    };
+    // clang-format oon
+
+    std::string line = "command1 one two -o1 --option2=three";
+    cl::Args args = cl::parse(line);
+    REQUIRE(args["command1"] == "command1");
+    REQUIRE(args["arg1_1"] == "one");
+    REQUIRE(args["arg1_2"] == "two");
+    REQUIRE(args["option1"] == true);
+    REQUIRE(args["option2"] == "three");
+
+    line = R"(  command1 'one two' "a \"b\" \c"  -o2 x\ y  )";
+    args = cl::parse(line);
+    REQUIRE(args["arg1_1"] == "one two");
+    REQUIRE(args["arg1_2"] == R"(a "b" \c)");
+    REQUIRE(args["option2"] == "x y");
+
+    line = "command1 '' two";
+    args = cl::parse(line);
+    REQUIRE(args["command1"] == "command1");
+    REQUIRE(args["arg1_2"] == "two");
+
+    line = "command1 a\"b c\"d \\\n";
+    args = cl::parse(line);
+    REQUIRE(args["arg1_1"] == "ab cd");
+    REQUIRE_FALSE(args["arg1_2"]);
+
+    line = "command1 'one";
+    auto res = cl::try_parse(line);
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_QUOTING);
+    REQUIRE(res.error().index == 2);
+
+    // Partly unescaped when the quote is found unterminated
+    line = "command1 a\\b'c \"d";
+    res = cl::try_parse(line);
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().token.empty());
+    REQUIRE(res.error().message() ==
+            "Unterminated quote or escape in argument 2");
+
+    line = "command1 one --option3";
+    res = cl::try_parse(line);
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_OPTION);
+    REQUIRE(res.error().index == 3);
+
+    line = "   ";
+    res = cl::try_parse(line);
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::HELP);
+}
+
+TEST_CASE("Batch", "[batch]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    std::vector<std::string> calls;
+
+    // clang-format off
+    cl::Options{
+        cl::opt("o1", "option1", "Option 1"),
+    };
+
+    cl::Usage{
+        cl::cmd("command1", "arg1_1", *--"option1"_p) >> [&](const cl::Args& args) {
+            calls.push_back(args.at("arg1_1").to_string() + (args.at("option1").to_bool() ? "+" : "-"));
+        },
+    };
+    // clang-format oon
+
+    std::FILE* f = std::tmpfile();
+    REQUIRE(f);
+
+    std::fputs("command1 one\n\n# comment\ncommand1 'two three' -o1\n", f);
+    std::fputs("command2 four\ncommand1 five\ncommand1 six", f);
+    std::rewind(f);
+
+    REQUIRE(cl::batch(f, true) == 1);
+    REQUIRE(calls == std::vector<std::string>{"one-", "two three+", "five-", "six-"});
+
+    calls.clear();
+    std::rewind(f);
+    REQUIRE(cl::batch(f) == 1);
+    REQUIRE(calls == std::vector<std::string>{"one-", "two three+"});
+
+    // Records longer than the read buffer
+    calls.clear();
+    std::rewind(f);
+    std::string big(200000, 'x');
+    std::fputs(("command1 " + big + "\ncommand1 end\n").c_str(), f);
+    std::fflush(f);
+    std::rewind(f);
+    REQUIRE(cl::batch(f) == 0);
+    REQUIRE(calls == std::vector<std::string>{big + "-", "end-"});
+    std::fclose(f);
+
+#if !defined(_WIN32)
+    // '--cl-batch' is only taken over after cl::enable_builtins()
+    REQUIRE(exit_code([] { parse_os("--cl-batch=/dev/null"); }) == 2);
+
+    REQUIRE(exit_code([] {
+                cl::enable_builtins();
+                parse_os("--cl-batch=/dev/null");
+            }) == 0);
+#endif
+}
+
+TEST_CASE("Parallel", "[parallel]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    std::mutex mutex;
+    std::unordered_map<std::string, std::vector<int>> calls;
+
+    cl::Usage{
+        cl::cmd("migrate", "resource", "index") >> [&](const cl::Args& args) {
+            std::lock_guard<std::mutex> lock{mutex};
+            calls[args.at("resource").to_string()].push_back(
+                std::stoi(args.at("index").to_string()));
+        },
+    };
+
+    std::FILE* f = std::tmpfile();
+    REQUIRE(f);
+
+    for(int i = 0; i < 1000; i++) {
+        std::string line = "migrate r" + std::to_string(i % 7) + " " +
+                           std::to_string(i) + "\n";
+        std::fputs(line.c_str(), f);
+    }
+
+    std::rewind(f);
+
+    size_t failed = cl::batch_parallel(f, 4, [](const cl::Args& args) {
+        return args.at("resource").to_stringview();
+    });
+
+    std::fclose(f);
+
+    REQUIRE(failed == 0);
+    REQUIRE(calls.size() == 7);
+
+    for(const auto& [r, indexes] : calls) {
+        REQUIRE(indexes.size() >= 142);
+        REQUIRE(std::is_sorted(indexes.begin(), indexes.end()));
+    }
+
+    std::string line = "migrate 'r 1' 42";
+    auto inv = cl::try_parse_invocation(line);
+    REQUIRE(inv);
+    line.assign(line.size(), 'x');
+    REQUIRE(inv->args["resource"] == "r 1");
+    REQUIRE(inv->args["index"] == "42");
+
+    calls.clear();
+    cl::Dispatcher dispatcher{2};
+    dispatcher.submit(std::move(*inv));
+    dispatcher.wait();
+    REQUIRE(calls["r 1"] == std::vector<int>{42});
+
+    // A throwing entry is reported, its strand and the worker go on
+    calls.clear();
+    auto entry = cl::Usage::items[0].entry;
+
+    cl::Usage::items[0] >> [&entry](const cl::Args& args) {
+        if(args.at("index") == "0")
+            throw std::runtime_error{"Migration failed"};
+
+        entry(args);
+    };
+
+    for(int k = 0; k < 2; k++) {
+        for(int i = 0; i < 3; i++) {
+            line = "migrate r " + std::to_string(i);
+            dispatcher.submit(std::move(*cl::try_parse_invocation(line)), "r");
+        }
+
+        dispatcher.wait();
+    }
+
+    REQUIRE(calls["r"] == std::vector<int>{1, 2, 1, 2});
+}
+
+TEST_CASE("Snapshot", "[snapshot]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    // clang-format off
+    cl::Options{
+        cl::opt("o1", "option1", "Option 1"),
+        cl::opt("o2", "option2"_o, "Option 2"),
+        cl::opt("o3", "option3"_o, "Option 3", [] { return std::string{"lazy"}; }),
+    };
+
+    cl::Usage{
+        cl::cmd("command1", "arg1_1", *"arg1_2"_p, *cl::one("foo", "bar"), *--"option1"_p, *--"option2"_p),
+    };
+    // clang-format on
+
+    std::string line = "command1 'one two' '' bar --option2=val";
+    cl::Args args = cl::parse(line);
+
+    std::vector<char> ring(1024);
+    size_t size = cl::snapshot_size(args);
+    REQUIRE(size % 8 == 0);
+    REQUIRE(cl::write_snapshot(args, ring.data(), size - 1) == 0);
+    REQUIRE(cl::write_snapshot(args, ring.data() + 3, ring.size() - 3) == size);
+
+    // Relocate it and destroy the source
+    std::vector<char> copy(ring.begin() + 3, ring.begin() + 3 + size);
+    line.assign(line.size(), 'x');
+    std::fill(ring.begin(), ring.end(), 0);
+
+    cl::SnapshotView view{copy.data(), copy.size()};
+    REQUIRE(view.valid());
+    REQUIRE_FALSE(cl::SnapshotView(copy.data(), size - 1).valid());
+    REQUIRE_FALSE(cl::SnapshotView(copy.data(), 3).valid());
+    REQUIRE_FALSE(cl::Snapshot{}.view().valid());
+    REQUIRE(cl::Snapshot{}.view().to_args().size() == 0);
+    REQUIRE(view.size() == size);
+    REQUIRE(view["command1"] == "command1");
+    REQUIRE(view["arg1_1"] == "one two");
+    REQUIRE(view["arg1_2"].is_null());
+    REQUIRE(view["foo"] == false);
+    REQUIRE(view["bar"] == true);
+    REQUIRE(view["option1"] == false);
+    REQUIRE(view["option2"] == "val");
+    REQUIRE(view["unknown"].is_null());
+
+    cl::Args restored = view.to_args();
+    REQUIRE(restored.size() == args.size());
+    REQUIRE(restored["arg1_1"] == "one two");
+    REQUIRE(restored["option2"] == "val");
+    REQUIRE(restored["option3"].is_null()); // Not an option of command1
+
+    cl::Snapshot owned = cl::snapshot(restored);
+    REQUIRE(owned.data == copy);
+
+    // Taken under another grammar
+    cl::Usage{cl::cmd("command2")};
+    cl::impl::finalize();
+    REQUIRE_FALSE(view.valid());
+    REQUIRE(view["arg1_1"].is_null());
+    REQUIRE(view.to_args().size() == 0);
+}
+
+TEST_CASE("Serializer", "[serializer]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    // clang-format off
+    cl::Options{
+        cl::opt("o1", "option1", "Option 1"),
+        cl::opt("o2", "option2"_o, "Option 2"),
+    };
+
+    cl::Usage{
+        cl::cmd("command1", "arg1_1", *"arg1_2"_p, *cl::one("foo", "bar"), *--"option1"_p, *--"option2"_p),
+    };
+    // clang-format oon
+
+    std::string line = R"(command1 'a "b"' '' bar --option2=$'\t')";
+    cl::Args args = cl::parse(line);
+    args["arg1_1"] = cl::Arg{std::string_view{"a \"b\"\x01"}};
+
+    char buffer[512];
+    size_t n = cl::serialize(args, buffer, sizeof(buffer));
+    REQUIRE(std::string_view{buffer, n} ==
+            R"({"command1":"command1","arg1_1":"a \"b\"\u0001","arg1_2":null,)"
+            R"("foo":false,"bar":true,"help":false,"version":false,)"
+            R"("option1":false,"option2":"$\\t"})");
+
+    REQUIRE(cl::serialize(args, buffer, 10) == n);
+
+    n = cl::serialize(args, buffer, sizeof(buffer), cl::Format::JSON_LINES);
+    REQUIRE(buffer[n - 1] == '\n');
+
+    n = cl::serialize(args, buffer, sizeof(buffer), cl::Format::BINARY);
+    REQUIRE(buffer[0] == 9);
+    REQUIRE(std::string_view{buffer + 1, 19} ==
+            "\x08" "command1\x03\x08" "command1");
+    REQUIRE(std::string_view{buffer + n - 8, 5} == "\x03\x03$\\t");
+
+    // No option family names, nothing after '--'
+    REQUIRE(std::string_view{buffer + n - 3, 3} ==
+            std::string_view{"\0\0\0", 3});
+}
+
+TEST_CASE("Handles", "[handles]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    auto verbose = cl::opt("v1", "verbose", "Verbose");
+    auto port = cl::opt("po", "port"_o, "Port");
+    cl::Options{verbose, port};
+
+    auto path = "path"_p;
+    auto mode = cl::one("fast", "slow");
+    auto serve = cl::cmd("serve", path, *mode, *--"port"_p, *--"v1"_p);
+    auto stop = cl::cmd("stop", *"path"_p);
+    cl::Usage{serve, stop};
+
+    std::string line = "serve /tmp slow -po 80 -v1";
+    cl::Args args = cl::parse(line);
+    REQUIRE(args[serve] == "serve");
+    REQUIRE(args[stop] == false);
+    REQUIRE(args[path] == "/tmp");
+    REQUIRE(args[mode["slow"]] == true);
+    REQUIRE(args[mode["fast"]] == false);
+    REQUIRE(args[mode["other"]].is_null());
+
+    // No slot for undeclared names, writes are dropped
+    args["undeclared"] = cl::Arg{true};
+    REQUIRE(args["undeclared"].is_null());
+    REQUIRE(args[port] == "80");
+    REQUIRE(args[verbose] == true);
+
+    // String keys are still available
+    cl::Handle h = port;
+    REQUIRE(h.get() == args.slot("port"));
+    REQUIRE(args["port"] == "80");
+    REQUIRE(args["unknown"].is_null());
+    REQUIRE_FALSE(args.count("unknown"));
+
+    const cl::Args& cargs = args;
+    REQUIRE(cargs[path] == "/tmp");
+    REQUIRE(cargs["path"] == "/tmp");
+    REQUIRE(cargs["unknown"].is_null());
+
+    // Iteration follows the grammar
+    std::vector<std::string_view> keys;
+
+    for(const auto& [k, a] : args)
+        keys.push_back(k);
+
+    REQUIRE(keys == std::vector<std::string_view>{
+                        "serve", "path", "fast", "slow", "stop", "help",
+                        "version", "verbose", "port"});
+
+    // Pairs bind to references, like with std::unordered_map
+    for(auto& [k, a] : args) {
+        if(k == "port")
+            a = cl::Arg{std::string_view{"8080"}};
+    }
+
+    REQUIRE(args["port"] == "8080");
+    REQUIRE(cargs.find("port")->second == "8080");
+    REQUIRE(cargs.find("port")->first == "port");
+    REQUIRE(cargs.find("unknown") == cargs.end());
+
+    auto it = cargs.find("verbose");
+    const auto& [k, v] = *it;
+    REQUIRE(k == "verbose");
+    REQUIRE(v == true);
+}
+
+TEST_CASE("Keys", "[keys]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    static_assert("verbose"_k.hash == cl::impl::hash("verbose"));
+
+    cl::Options{
+        cl::opt("v1", "verbose", "Verbose"),
+    };
+
+    cl::Usage{
+        cl::cmd("command1", "arg1_1", *--"verbose"_p),
+    };
+
+    std::string line = "command1 one --verbose";
+    cl::Args args = cl::parse(line);
+    REQUIRE(args["verbose"_k] == true);
+    REQUIRE(args["arg1_1"_k] == "one");
+    REQUIRE(args[std::string{"arg1_1"}] == "one");
+    REQUIRE(args["unknown"_k].is_null());
+
+    std::vector<std::string> names;
+    std::vector<std::string_view> items;
+
+    for(int i = 0; i < 1000; i++)
+        names.push_back("key" + std::to_string(i));
+
+    for(int i = 0; i < 1000; i++)
+        items.emplace_back(names[i]);
+
+    cl::impl::KeyTable table;
+    table.build(items);
+    REQUIRE(table.buckets.size() == 2048);
+
+    for(int i = 0; i < 1000; i++)
+        REQUIRE(table.find(names[i]) == static_cast<uint32_t>(i));
+
+    REQUIRE(table.find("key1000") == cl::Handle::NO_SLOT);
+    REQUIRE(table.find("") == cl::Handle::NO_SLOT);
+}
+
+struct ServeConfig {
+    std::string_view path;
+    int port{8080};
+    bool verbose{false};
+    std::optional<double> ratio;
+    bool fast{false};
+};
+
+struct StopConfig {
+    std::string path{"/"};
+};
+
+TEST_CASE("Bind", "[bind]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    auto port = cl::opt("po", "port"_o, "Port");
+    cl::Options{
+        cl::opt("v1", "verbose", "Verbose"),
+        port,
+        cl::opt("ra", "ratio"_o, "Ratio"),
+    };
+
+    auto mode = cl::one("fast", "slow");
+    cl::Usage{
+        cl::cmd("serve", "path", *mode, *--"port"_p, *--"v1"_p, *--"ra"_p),
+        cl::cmd("stop", *"path"_p),
+    };
+
+    auto serve = cl::binder<ServeConfig>(
+        cl::bind(&ServeConfig::path, "path"),
+        cl::bind(&ServeConfig::port, port),
+        cl::bind(&ServeConfig::verbose, "verbose"),
+        cl::bind(&ServeConfig::ratio, "ratio"),
+        cl::bind(&ServeConfig::fast, mode["fast"]));
+
+    std::string line = "serve /tmp fast -po 80 -v1 --ratio=0.5";
+    cl::Result<ServeConfig> cfg = cl::try_parse_into(line, serve);
+    REQUIRE(cfg);
+    REQUIRE(cfg->path == "/tmp");
+    REQUIRE(cfg->port == 80);
+    REQUIRE(cfg->verbose);
+    REQUIRE(cfg->ratio == 0.5);
+    REQUIRE(cfg->fast);
+
+    // Missing values keep their initializers
+    line = "serve /tmp";
+    cfg = cl::try_parse_into(line, serve);
+    REQUIRE(cfg);
+    REQUIRE(cfg->port == 8080);
+    REQUIRE_FALSE(cfg->verbose);
+    REQUIRE_FALSE(cfg->ratio);
+
+    line = "serve /tmp -po http";
+    cfg = cl::try_parse_into(line, serve);
+    REQUIRE_FALSE(cfg);
+    REQUIRE(cfg.error().code == cl::ErrorCode::INVALID_VALUE);
+    REQUIRE(cfg.error().index == 4);
+    REQUIRE(cfg.error().token == "http");
+    REQUIRE(cfg.error().message() == "Invalid value 'http'");
+
+    // Grammar errors are reported as usual
+    line = "serve";
+    cfg = cl::try_parse_into(line, serve);
+    REQUIRE(cfg.error().code == cl::ErrorCode::MISSING_ARGUMENT);
+
+    // One struct per command
+    auto servecmd = cl::command<ServeConfig>(
+        "serve", cl::bind(&ServeConfig::path, "path"),
+        cl::bind(&ServeConfig::port, "port"));
+
+    auto stopcmd =
+        cl::command<StopConfig>("stop", cl::bind(&StopConfig::path, "path"));
+
+    line = "stop /var";
+    auto res = cl::try_parse_as(line, servecmd, stopcmd);
+    REQUIRE(res);
+    REQUIRE(std::get<StopConfig>(*res).path == "/var");
+
+    line = "serve /tmp -po 81";
+    res = cl::try_parse_as(line, servecmd, stopcmd);
+    REQUIRE(res);
+    REQUIRE(std::get<ServeConfig>(*res).port == 81);
+
+    line = "stop";
+    auto unbound = cl::try_parse_as(line, servecmd);
+    REQUIRE(unbound.error().code == cl::ErrorCode::UNKNOWN_COMMAND);
+    REQUIRE(unbound.error().token == "stop");
+}
+
+TEST_CASE("Parser", "[parser]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    int called = 0;
+
+    cl::Options{
+        cl::opt("v1", "verbose", "Verbose"),
+        cl::opt("po", "port"_o, "Port"),
+    };
+
+    cl::Usage{
+        cl::cmd("serve", "path", *--"verbose"_p, *--"port"_p) >>
+            [&](const cl::Args&) { ++called; },
+    };
+
+    std::string line = "serve /tmp -po 80";
+    cl::Result<cl::Args> res = cl::Parser<>::try_parse(line);
+    REQUIRE(res);
+    REQUIRE(res->at("port") == "80");
+    REQUIRE(called == 1);
+
+    line = "serve /tmp -v1";
+    res = cl::Parser<cl::NoEntry>::try_parse(line);
+    REQUIRE(res);
+    REQUIRE(res->at("verbose") == true);
+    REQUIRE(called == 1);
+
+    // Valued options are rejected and '=' is not split
+    using FlagsOnly = cl::Parser<cl::NoHelp, cl::NoEntry, cl::FlagsOnly>;
+
+    line = "serve /tmp --verbose";
+    res = FlagsOnly::try_parse(line);
+    REQUIRE(res);
+    REQUIRE(res->at("verbose") == true);
+    REQUIRE(res->at("port").is_null());
+
+    line = "serve /tmp -po 80";
+    res = FlagsOnly::try_parse(line);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_OPTION_FORMAT);
+    REQUIRE(res.error().token == "-po");
+
+    line = "serve /tmp --verbose=1";
+    res = FlagsOnly::try_parse(line);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_OPTION);
+
+#if !defined(_WIN32)
+    // Exit codes are the same of cl::parse()
+    for(const char* l : {"serve /tmp extra", "serve"}) {
+        int expected = exit_code([l] {
+            std::string s = l;
+            cl::parse(s);
+        });
+
+        int nohelp = exit_code([l] {
+            std::string s = l;
+            cl::Parser<cl::NoHelp>::parse(s);
+        });
+
+        REQUIRE(nohelp == expected);
+    }
+#endif
+}
+
+TEST_CASE("Cache", "[cache]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    std::atomic<int> called{0};
+
+    cl::Usage{
+        cl::cmd("get", "key") >> [&](const cl::Args&) { ++called; },
+        cl::cmd("set", "key", "value"),
+    };
+
+    cl::ParseCache cache{64 * 1024, 4};
+
+    cl::CachedResult a = cache.try_parse("set 'k 1' v");
+    REQUIRE(*a);
+    REQUIRE(a->args["key"] == "k 1");
+    REQUIRE(a->args["value"] == "v");
+
+    // Hits share the same immutable result
+    cl::CachedResult b = cache.try_parse("set 'k 1' v");
+    REQUIRE(a == b);
+    REQUIRE(cache.stats().hits == 1);
+    REQUIRE(cache.stats().misses == 1);
+
+    // Entries are not called by the cache
+    cl::CachedResult get = cache.try_parse("get k");
+    REQUIRE(called == 0);
+    (*get)();
+    REQUIRE(called == 1);
+
+    // Failures are cached too, tokens refer to the cached text
+    cl::CachedResult err = cache.try_parse("del k");
+    REQUIRE_FALSE(*err);
+    REQUIRE(err->error.code == cl::ErrorCode::UNKNOWN_COMMAND);
+    REQUIRE(err->error.token == "del");
+    REQUIRE(cache.try_parse("del k") == err);
+
+    std::initializer_list<const char*> argv = {"", "get", "k"};
+    cl::CachedResult fromargv =
+        cache.try_parse(argv.size(), const_cast<char**>(argv.begin()));
+    REQUIRE(fromargv != get); // Different keys
+    REQUIRE(fromargv->args["key"] == "k");
+    REQUIRE(cache.try_parse(argv.size(), const_cast<char**>(argv.begin())) ==
+            fromargv);
+
+    cl::CacheStats stats = cache.stats();
+    REQUIRE(stats.hits == 3);
+    REQUIRE(stats.misses == 4);
+    REQUIRE(stats.entries == 4);
+    REQUIRE(stats.size <= 64 * 1024);
+
+    // Least recently used entries are evicted to stay below the cap
+    cl::ParseCache small{a->size * 3, 1};
+
+    for(int i = 0; i < 100; i++)
+        small.try_parse("get " + std::to_string(i % 10));
+
+    stats = small.stats();
+    REQUIRE(stats.entries >= 1);
+    REQUIRE(stats.entries <= 3);
+    REQUIRE(stats.size <= a->size * 3);
+    REQUIRE(stats.misses == 100);
+
+    cl::ParseCache shared{64 * 1024};
+    std::vector<std::thread> threads;
+
+    for(int t = 0; t < 4; t++) {
+        threads.emplace_back([&shared]() {
+            for(int i = 0; i < 1000; i++) {
+                cl::CachedResult r =
+                    shared.try_parse("get " + std::to_string(i % 50));
+
+                if(!*r || r->args["key"] != std::to_string(i % 50))
+                    std::abort();
+            }
+        });
+    }
+
+    for(std::thread& t : threads)
+        t.join();
+
+    stats = shared.stats();
+    REQUIRE(stats.entries == 50);
+    REQUIRE(stats.hits + stats.misses == 4000);
+    REQUIRE(stats.misses >= 50);
+}
+
+TEST_CASE("Line parser", "[repl]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    cl::Options{
+        cl::opt("v1", "verbose", "Verbose"),
+        cl::opt("po", "port"_o, "Port"),
+    };
+
+    cl::Usage{
+        cl::cmd("serve", "path", *cl::one("fast", "slow"), *--"verbose"_p,
+                *--"port"_p),
+    };
+
+    cl::LineParser lp;
+    REQUIRE(lp.update("").code == cl::ErrorCode::HELP);
+    REQUIRE(lp.update("ser").code == cl::ErrorCode::UNKNOWN_COMMAND);
+    REQUIRE(lp.update("serve").code == cl::ErrorCode::MISSING_ARGUMENT);
+    REQUIRE(lp.update("serve '/tmp/a b").code == cl::ErrorCode::INVALID_QUOTING);
+    REQUIRE(lp.reused == 0);
+
+    REQUIRE(lp.update("serve '/tmp/a b' -po").code ==
+            cl::ErrorCode::INVALID_SHORT_OPTION_FORMAT);
+    REQUIRE(lp.reused == 1);
+
+    // The short option has to be matched again when its value is typed
+    REQUIRE(lp.update("serve '/tmp/a b' -po 80 fas").code ==
+            cl::ErrorCode::INVALID_ARGUMENT);
+    REQUIRE(lp.reused == 2);
+    REQUIRE(lp.error().token == "fas");
+    REQUIRE(lp.error().index == 5);
+
+    REQUIRE(lp.update("serve '/tmp/a b' -po 80 fast").code ==
+            cl::ErrorCode::NONE);
+    REQUIRE(lp.reused == 4);
+
+    const std::vector<cl::LineToken>& tokens = lp.tokens();
+    REQUIRE(tokens.size() == 5);
+    REQUIRE(tokens[0].kind == cl::TokenKind::COMMAND);
+    REQUIRE(tokens[1].kind == cl::TokenKind::ARGUMENT);
+    REQUIRE(tokens[1].val == "/tmp/a b");
+    REQUIRE(tokens[1].begin == 6);
+    REQUIRE(tokens[1].end == 16);
+    REQUIRE(tokens[2].kind == cl::TokenKind::OPTION);
+    REQUIRE(tokens[3].kind == cl::TokenKind::VALUE);
+    REQUIRE(tokens[4].kind == cl::TokenKind::ARGUMENT);
+
+    cl::Result<cl::Args> args = lp.args();
+    REQUIRE(args);
+    REQUIRE(args->at("path") == "/tmp/a b");
+    REQUIRE(args->at("port") == "80");
+    REQUIRE(args->at("fast") == true);
+
+    // Editing the middle of the line keeps the tokens before it
+    REQUIRE(lp.update("serve '/tmp/a b' --verbose -po 80 fast").code ==
+            cl::ErrorCode::NONE);
+    REQUIRE(lp.reused == 2);
+    REQUIRE(lp.args()->at("verbose") == true);
+
+    // Repeated options replace the previous value
+    REQUIRE(lp.update("serve '/tmp/a b' --verbose -po 80 fast -po 81").code ==
+            cl::ErrorCode::NONE);
+    REQUIRE(lp.args()->at("port") == "81");
+    REQUIRE(lp.update("serve '/tmp/a b' --verbose -po 80 fast").code ==
+            cl::ErrorCode::NONE);
+    REQUIRE(lp.args()->at("port") == "80");
+
+    REQUIRE(lp.update("serve /tmp -x").code == cl::ErrorCode::INVALID_OPTION);
+    REQUIRE(lp.error().token == "-x");
+
+    // Random edits give the same results as parsing the line again
+    const char* pieces[] = {"serve", "ser",   "/tmp",     "'a b'", "'a",
+                            "\"x",   "\\",   "-po",      "80",    "--port=8",
+                            "-v1",   "fast",  "slow",     "--",    "-x",
+                            "--bogus", "\\--", "--verbose", "",      " "};
+
+    std::mt19937 rng{42};
+    std::string line;
+
+    for(int i = 0; i < 5000; i++) {
+        std::string piece = pieces[rng() % std::size(pieces)];
+        size_t at = rng() % 4 ? line.size() : rng() % (line.size() + 1);
+
+        if(rng() % 16 == 0)
+            line = "serve /tmp";
+        else if(rng() % 4)
+            line.insert(at, " " + piece);
+        else
+            line.erase(rng() % (line.size() + 1));
+
+        lp.update(line);
+        std::string copy = line;
+        cl::Result<cl::Args> expected = cl::try_parse(copy);
+
+        INFO(line);
+        REQUIRE(lp.error().code == (expected ? cl::ErrorCode::NONE
+                                             : expected.error().code));
+
+        if(!expected) {
+            REQUIRE(lp.error().index == expected.error().index);
+            continue;
+        }
+
+        args = lp.args();
+        REQUIRE(args);
+        REQUIRE(args->rest.line == expected->rest.line);
+
+        for(const char* name : {"serve", "path", "port", "verbose", "fast"})
+            REQUIRE(args->at(name).dump() == expected->at(name).dump());
+    }
+}
+
+TEST_CASE("Complete", "[complete]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    cl::Options{
+        cl::opt("v1", "verbose", "Verbose"),
+        cl::opt("po", "port"_o, "Port"),
+        cl::opt("pr", "proto"_o, "Protocol"),
+        cl::opt("fo", "force", "Force"),
+    };
+
+    cl::Usage{
+        cl::cmd("serve", "path", *cl::one("fast", "slow", "safe"),
+                *--"verbose"_p, *--"port"_p, *--"proto"_p),
+        cl::cmd("stop", "path", *--"force"_p),
+        cl::cmd("status"),
+        cl::cmd("run"_a, cl::one("job", "jobs"), "name"),
+        cl::cmd("exec"_a, cl::one("jobs", "task"), *--"force"_p),
+    };
+
+    auto complete = [](std::initializer_list<const char*> words) {
+        std::vector<const char*> argv = {"app"};
+        argv.insert(argv.end(), words.begin(), words.end());
+        return cl::complete(static_cast<int>(argv.size()),
+                            const_cast<char**>(argv.data()),
+                            static_cast<int>(argv.size()) - 1);
+    };
+
+    using Names = std::vector<std::string>;
+
+    REQUIRE(complete({"st"}) == Names{"status", "stop"});
+    REQUIRE(complete({""}) == Names{"serve", "status", "stop"});
+    REQUIRE(complete({"x"}).empty());
+
+    // Options allowed for the command and not given yet
+    REQUIRE(complete({"serve", "--p"}) == Names{"--port", "--proto"});
+    REQUIRE(complete({"serve", "-po", "80", "-p"}) == Names{"-pr"});
+    REQUIRE(complete({"serve", "--port=80", "--"}) ==
+            Names{"--proto", "--verbose"});
+    REQUIRE(complete({"serve", "-"}) ==
+            Names{"-po", "-pr", "-v1", "--port", "--proto", "--verbose"});
+    REQUIRE(complete({"stop", "--"}) == Names{"--force"});
+    REQUIRE(complete({"serve", "--port="}).empty());
+
+    // Choices of the current positional, none for free values
+    REQUIRE(complete({"serve", "/tmp", "s"}) == Names{"safe", "slow"});
+    REQUIRE(complete({"serve", "-v1", "/tmp", ""}) ==
+            Names{"fast", "safe", "slow"});
+    REQUIRE(complete({"serve", ""}).empty());
+    REQUIRE(complete({"serve", "/tmp", "-po", ""}).empty());
+
+    // Any-commands still accepting the positionals
+    REQUIRE(complete({"x", "j"}) == Names{"job", "jobs"});
+    REQUIRE(complete({"x", "task", "--"}) == Names{"--force"});
+    REQUIRE(complete({"x", "jobs", "--"}) == Names{"--force"});
+    REQUIRE(complete({"x", "job", "--"}).empty());
+
+    // argv[cursor] does not have to be the last word
+    std::vector<const char*> argv = {"app", "serve", "/tmp", "sl", "-v1"};
+    REQUIRE(cl::complete(5, const_cast<char**>(argv.data()), 3) ==
+            Names{"slow"});
+
+#if !defined(_WIN32)
+    // The bash script offers the same candidates, '=' aside
+    char path[] = "/tmp/cl-complete-XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd != -1);
+
+    std::string script = cl::completion_script("bash", "app");
+    REQUIRE(write(fd, script.data(), script.size()) ==
+            static_cast<ssize_t>(script.size()));
+    close(fd);
+
+    auto bash = [&path](const std::string& line) {
+        // compopt only works while bash is completing
+        std::string cmd = "COMP_LINE='app " + line +
+                          "' bash -c 'compopt() { :; }; . " + path +
+                          "; COMP_POINT=${#COMP_LINE}; _cl_app; "
+                          "printf \"%s\\n\" \"${COMPREPLY[@]}\"'";
+
+        Names res;
+        char buf[256];
+        FILE* p = popen(cmd.c_str(), "r");
+
+        while(p && std::fgets(buf, sizeof(buf), p)) {
+            std::string w = buf;
+            w.pop_back();
+
+            if(!w.empty() && w.back() == '=')
+                w.pop_back();
+            if(!w.empty())
+                res.push_back(w);
+        }
+
+        if(p)
+            pclose(p);
+
+        std::sort(res.begin(), res.end());
+        return res;
+    };
+
+    for(std::string line :
+        {"", "st", "serve -", "serve --p", "serve -po 80 -p",
+         "serve --port=80 --", "serve --port=80 -- ", "stop /x -",
+         "serve /tmp ", "serve /tmp s", "serve -v1 /tmp ", "serve ",
+         "serve /tmp -po ", "x j", "x task --", "x jobs --", "x job --",
+         "serve /tmp -- ", "x task -- -"}) {
+        std::vector<std::string> words = {"app"};
+        std::istringstream in{line};
+
+        for(std::string w; in >> w;)
+            words.push_back(w);
+
+        if(line.empty() || line.back() == ' ')
+            words.emplace_back();
+
+        std::vector<char*> args;
+
+        for(std::string& w : words)
+            args.push_back(w.data());
+
+        auto argc = static_cast<int>(args.size());
+        Names expected = cl::complete(argc, args.data(), argc - 1);
+        std::sort(expected.begin(), expected.end());
+
+        INFO(line);
+        REQUIRE(bash(line) == expected);
+    }
+
+    unlink(path);
+#endif
+}
+
+TEST_CASE("Completion script", "[complete]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    cl::Options{
+        cl::opt("v1", "verbose", "Verbose"),
+        cl::opt("po", "port"_o, "Port"),
+        cl::opt("q", "quiet", "Not resolvable short name"),
+        cl::opt("ws", "with space", "Not a shell word"),
+    };
+
+    cl::Usage{
+        cl::cmd("serve", cl::one("fast", "slow", "$(rm)"), *--"port"_p),
+        cl::cmd("stop", *--"verbose"_p),
+        cl::cmd("run"_a, cl::one("job", "jobs")),
+    };
+
+    auto contains = [](const std::string& s, std::string_view x) {
+        return s.find(x) != std::string::npos;
+    };
+
+    std::string bash = cl::completion_script("bash", "my-app");
+    REQUIRE(contains(bash, "_cl_my_app() {\n"));
+    REQUIRE(contains(bash, "complete -F _cl_my_app my-app\n"));
+    REQUIRE(contains(bash, "compgen -W 'serve stop' -- \"$cur\""));
+    REQUIRE(contains(bash, "po|port) given+='-po --port= '; [[ $w == --* ]] "
+                           "|| skip=1 ;;"));
+    REQUIRE(contains(bash, "quiet) given+='--quiet ' ;;"));
+    REQUIRE(contains(bash, "0) choices+='fast slow ' ;;"));
+    REQUIRE(contains(bash, "[[ ' job jobs ' == *\" $w \"* ]] || dead+='2 '"));
+    REQUIRE(contains(bash, "*) cmds=' 2 ' ;;"));
+    REQUIRE(contains(bash, "elif [[ $w == -- ]]; then\n            return\n"));
+
+    // Names needing quotes are left out
+    REQUIRE_FALSE(contains(bash, "$(rm)"));
+    REQUIRE_FALSE(contains(bash, "with space"));
+    REQUIRE_FALSE(contains(bash, " \n"));
+
+    std::string zsh = cl::completion_script("zsh", "my-app");
+    REQUIRE(contains(zsh, "compdef _cl_my_app my-app\n"));
+    REQUIRE(contains(zsh, "compadd -S '' -- $values"));
+    REQUIRE(contains(zsh, "elif [[ $w == -- ]]; then\n            return\n"));
+
+    std::string fish = cl::completion_script("fish", "my-app");
+    REQUIRE(contains(fish, "complete -c my-app -f -a '(_cl_my_app)'\n"));
+    REQUIRE(contains(fish, "case po port\n"));
+    REQUIRE(contains(fish, "contains -- $w job jobs; or set -a dead 2\n"));
+    REQUIRE(contains(fish, "if test \"$w\" = --\n                return\n"));
+
+    REQUIRE(cl::completion_script("tcsh").empty());
+
+#if !defined(_WIN32)
+    // '--cl-completion' is only taken over after cl::enable_builtins()
+    REQUIRE(exit_code([] { parse_os("--cl-completion=bash"); }) == 2);
+
+    REQUIRE(exit_code([] {
+                cl::enable_builtins();
+                parse_os("--cl-completion=bash");
+            }) == 0);
+#endif
+}
+
+TEST_CASE("Abbreviations", "[abbreviations]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    cl::Options{
+        cl::opt("v1", "verbose", "Verbose"),
+        cl::opt("o", "output"_o, "Output"),
+        cl::opt("ow", "overwrite", "Overwrite"),
+        cl::opt("vt", "verbatim", "Verbatim"),
+    };
+
+    cl::Usage{
+        cl::cmd("serve", *--"verbose"_p, *--"output"_p, *--"overwrite"_p),
+        cl::cmd("status", *--"verbatim"_p),
+        cl::cmd("stash"),
+        cl::cmd("any"_a, cl::one("alpha", "beta")),
+    };
+
+    // Args refer to the lines, they are kept until the end
+    std::list<std::string> lines;
+
+    auto parse = [&lines](const char* line) {
+        return cl::try_parse(lines.emplace_back(line));
+    };
+
+    cl::abbreviations = false;
+    REQUIRE(parse("serve --verb").error().code ==
+            cl::ErrorCode::INVALID_OPTION);
+    REQUIRE(parse("stat").error().code ==
+            cl::ErrorCode::UNKNOWN_COMMAND);
+
+    cl::abbreviations = true;
+
+    cl::Result<cl::Args> res = parse("serve --verb --out=file");
+    REQUIRE(res);
+    REQUIRE((*res)["verbose"] == true);
+    REQUIRE((*res)["output"] == "file");
+    REQUIRE((*res)["overwrite"] == false);
+
+    // Only the options of the command are candidates
+    REQUIRE(parse("status --verb"));
+    REQUIRE(parse("serve --verb --help"));
+
+    // Abbreviated commands hold their full name
+    cl::Result<cl::Args> cmd = parse("se --overw");
+    REQUIRE(cmd);
+    REQUIRE((*cmd)["serve"] == "serve");
+    REQUIRE((*cmd)["overwrite"] == true);
+    REQUIRE(parse("stat"));
+
+    cl::Result<cl::Args> opt = parse("serve --ver");
+    REQUIRE(opt.error().code == cl::ErrorCode::AMBIGUOUS_OPTION);
+    REQUIRE(opt.error().index == 2);
+    REQUIRE(cl::suggest(opt.error()) ==
+            std::vector<std::string>{"--verbose", "--version"});
+    REQUIRE(cl::impl::describe(opt.error()) ==
+            "Ambiguous option '--ver' (did you mean '--verbose', "
+            "'--version'?)");
+
+    cl::Result<cl::Args> st = parse("st");
+    REQUIRE(st.error().code == cl::ErrorCode::AMBIGUOUS_COMMAND);
+    REQUIRE(cl::suggest(st.error(), 1) == std::vector<std::string>{"stash"});
+
+    // Short names are never abbreviated
+    REQUIRE(parse("serve -v").error().code ==
+            cl::ErrorCode::INVALID_OPTION);
+
+    // An any-command accepting the command line wins
+    cl::Result<cl::Args> any = parse("st alpha");
+    REQUIRE(any);
+    REQUIRE((*any)["any"] == "st");
+    REQUIRE(parse("al").error().code ==
+            cl::ErrorCode::UNKNOWN_COMMAND);
+    REQUIRE(parse("s").error().code ==
+            cl::ErrorCode::AMBIGUOUS_COMMAND);
+
+    cl::abbreviations = false;
+}
+
+TEST_CASE("Option families", "[families]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    std::vector<std::string> machines;
+
+    for(int i = 0; i < 3000; i++)
+        machines.push_back("arch" + std::to_string(i));
+
+    cl::Options{
+        cl::opt("v1", "verbose", "Verbose"),
+        cl::family("f", "features", {"pic", "lto", "inline"}, "Features"),
+        cl::family("fsan-", "sanitizers", {"address", "thread"}),
+        cl::family("W", "warnings", {}, "Warnings"),
+        cl::family("m", "machine",
+                   std::vector<std::string_view>(machines.begin(),
+                                                 machines.end())),
+    };
+
+    cl::Usage{
+        cl::cmd("build", "src", *--"verbose"_p, *--"features"_p,
+                *--"sanitizers"_p, *--"warnings"_p, *--"machine"_p),
+        cl::cmd("clean", *--"verbose"_p),
+    };
+
+    std::list<std::string> lines;
+
+    auto parse = [&lines](const char* line) {
+        return cl::try_parse(lines.emplace_back(line));
+    };
+
+    cl::Result<cl::Args> res =
+        parse("build a.c -fpic -fno-lto -Wall -Wno-unused -march2999");
+    REQUIRE(res);
+    REQUIRE(res->flag("features", "pic") == true);
+    REQUIRE(res->flag("features", "lto") == false);
+    REQUIRE(res->flag("features", "inline") == std::nullopt);
+    REQUIRE(res->flag("warnings", "all") == true);
+    REQUIRE(res->flag("warnings", "unused") == false);
+    REQUIRE(res->flag("warnings", "extra") == std::nullopt);
+    REQUIRE(res->flag("warnings", "no-") == std::nullopt);
+    REQUIRE(res->flag("machine", "arch2999") == true);
+    REQUIRE(res->flag("machine", "arch0") == std::nullopt);
+    REQUIRE(res->flag("verbose", "pic") == std::nullopt);
+
+    // One value per family, not per name
+    REQUIRE((*res)["features"] == true);
+    REQUIRE((*res)["sanitizers"] == false);
+    REQUIRE(res->count("pic") == 0);
+
+    // The last one wins, the longest prefix wins
+    res = parse("build a.c -fno-pic -fsan-thread -fpic -fno-inline -finline");
+    REQUIRE(res);
+    REQUIRE(res->flag("features", "pic") == true);
+    REQUIRE(res->flag("features", "inline") == true);
+    REQUIRE(res->flag("sanitizers", "thread") == true);
+    REQUIRE(res->flag("sanitizers", "address") == std::nullopt);
+
+    auto code = [&](const char* line) { return parse(line).error().code; };
+
+    REQUIRE(code("build a.c -fbogus") == cl::ErrorCode::INVALID_OPTION);
+    REQUIRE(parse("build a.c -fbogus").error().token == "-fbogus");
+    REQUIRE(code("build a.c -f") == cl::ErrorCode::INVALID_OPTION);
+    REQUIRE(code("build a.c -fno-") == cl::ErrorCode::INVALID_OPTION);
+    REQUIRE(code("build a.c -Wno-") == cl::ErrorCode::INVALID_OPTION);
+    REQUIRE(code("build a.c --features") == cl::ErrorCode::INVALID_OPTION);
+    REQUIRE(code("build a.c --fpic") == cl::ErrorCode::INVALID_OPTION);
+    REQUIRE(code("clean -fpic") == cl::ErrorCode::UNEXPECTED_OPTION);
+
+    REQUIRE(cl::Options::items[3].to_string() == "-f[no-]<features>");
+    REQUIRE(cl::Options::items[3].to_short_string().empty());
+
+    // Names of open families refer to the copy of an Invocation
+    std::string line = "build a.c -Wzap";
+    auto inv = cl::try_parse_invocation(line);
+    REQUIRE(inv);
+    line.assign(line.size(), 'X');
+    REQUIRE(inv->args.flag("warnings", "zap") == true);
+    REQUIRE(inv->args.others[0].name == "zap");
+
+    // Names follow edits of the line
+    cl::LineParser parser;
+    parser.update("build a.c -fpic -fno-lto");
+    parser.update("build a.c -fpic -flto -Wextra");
+    REQUIRE(parser.error().code == cl::ErrorCode::NONE);
+
+    cl::Result<cl::Args> args = parser.args();
+    REQUIRE(args->flag("features", "pic") == true);
+    REQUIRE(args->flag("features", "lto") == true);
+    REQUIRE(args->flag("warnings", "extra") == true);
+
+    parser.update("build a.c -fpic");
+    args = parser.args();
+    REQUIRE(args->flag("features", "lto") == std::nullopt);
+    REQUIRE(args->flag("warnings", "extra") == std::nullopt);
+
+    // Serialized after the arguments, the last occurrence of each name
+    res = parse("build a.c -fpic -fno-lto -Wall -Wno-all -Wextra");
+    REQUIRE(res);
+
+    char buffer[1024];
+    std::string_view json{buffer, cl::serialize(*res, buffer, sizeof(buffer))};
+    REQUIRE(json.substr(json.find("\"machine\":false") + 15) ==
+            R"(,"-f":{"pic":true,"lto":false},)"
+            R"("-W":{"all":false,"extra":true}})");
+
+    std::string_view bin{buffer, cl::serialize(*res, buffer, sizeof(buffer),
+                                               cl::Format::BINARY)};
+    REQUIRE(bin.substr(bin.size() - 33, 31) ==
+            std::string_view{"\x04\x01" "f\x03" "pic\x01\x01" "f\x03" "lto\x00"
+                             "\x01W\x03" "all\x00\x01W\x05" "extra\x01", 31});
+
+    // Stored in snapshots
+    cl::Snapshot snap = cl::snapshot(*res);
+    lines.back().assign(lines.back().size(), 'X');
+    cl::Args restored = snap.view().to_args();
+    REQUIRE(restored.flag("features", "pic") == true);
+    REQUIRE(restored.flag("features", "lto") == false);
+    REQUIRE(restored.flag("features", "inline") == std::nullopt);
+    REQUIRE(restored.flag("warnings", "all") == false);
+    REQUIRE(restored.flag("warnings", "extra") == true);
+}
+
+TEST_CASE("Terminator", "[terminator]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    // clang-format off
+    cl::Options{
+        cl::opt("v1", "verbose", "Verbose"),
+        cl::opt("en", "env"_o, "Environment"),
+    };
+
+    cl::Usage{
+        cl::cmd("exec", *"name"_p, *--"verbose"_p, *--"env"_p),
+    };
+    // clang-format on
+
+    std::initializer_list<const char*> arr = {
+        "", "exec", "--verbose", "--", "ls", "-la", "--", "--color", nullptr};
+
+    auto argv = const_cast<char**>(arr.begin());
+    auto res = cl::try_parse(static_cast<int>(arr.size()) - 1, argv);
+    REQUIRE(res);
+    REQUIRE((*res)["verbose"] == true);
+    REQUIRE_FALSE((*res)["name"]);
+
+    // A view into argv, not a copy
+    const cl::Rest& rest = res->rest;
+    REQUIRE(rest.argv == argv + 4);
+    REQUIRE(rest.size() == 4);
+    REQUIRE(rest[0] == "ls");
+    REQUIRE(rest[3] == "--color");
+    REQUIRE(rest.argv[rest.argc] == nullptr);
+    REQUIRE(std::distance(rest.begin(), rest.end()) == 4);
+
+    // Serialized and stored in snapshots
+    char buffer[256];
+    std::string_view json{buffer, cl::serialize(*res, buffer, sizeof(buffer))};
+    REQUIRE(json.substr(json.find(",\"--\"")) ==
+            R"(,"--":["ls","-la","--","--color"]})");
+
+    std::string_view bin{buffer, cl::serialize(*res, buffer, sizeof(buffer),
+                                               cl::Format::BINARY)};
+    REQUIRE(bin.substr(bin.size() - 20) ==
+            std::string_view{"\x04\x02ls\x03-la\x02--\x07--color\x00", 20});
+
+    cl::Snapshot snap = cl::snapshot(*res);
+    cl::SnapshotView view = snap.view();
+    REQUIRE(view.rest_size() == 4);
+    REQUIRE(view.rest(1) == "-la");
+    REQUIRE(view.rest(3) == "--color");
+    REQUIRE(view.rest(4).empty());
+
+    res = try_parse_os("exec", "--verbose");
+    REQUIRE(res);
+    REQUIRE(res->rest.empty());
+    json = {buffer, cl::serialize(*res, buffer, sizeof(buffer))};
+    REQUIRE(json.find("\"--\"") == std::string_view::npos);
+
+    // A short option value is not a terminator
+    res = try_parse_os("exec", "-en", "--", "--", "--unknown");
+    REQUIRE(res);
+    REQUIRE((*res)["env"] == "--");
+    REQUIRE(res->rest.size() == 1);
+
+    res = try_parse_os("exec", "--bogus", "--", "x");
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_OPTION);
+
+    res = try_parse_os("exec", "a", "b", "--", "x");
+    REQUIRE(res.error().code == cl::ErrorCode::TOO_MANY_ARGUMENTS);
+    REQUIRE(res.error().index == 3);
+
+    // Lines are not tokenized after '--'
+    std::string line = R"(exec prog --  rm 'a b' -rf "c)";
+    res = cl::try_parse(line);
+    REQUIRE(res);
+    REQUIRE((*res)["name"] == "prog");
+    REQUIRE(res->rest.line == R"(rm 'a b' -rf "c)");
+    REQUIRE(res->rest.size() == 0);
+
+    json = {buffer, cl::serialize(*res, buffer, sizeof(buffer))};
+    REQUIRE(json.substr(json.find(",\"--\"")) ==
+            R"(,"--":"rm 'a b' -rf \"c"})");
+
+    snap = cl::snapshot(*res);
+    line.assign(line.size(), 'x');
+    REQUIRE(snap.view().to_args().rest.line == R"(rm 'a b' -rf "c)");
+
+    cl::ParseCache cache{64 * 1024};
+    auto cached = cache.try_parse(static_cast<int>(arr.size()) - 1, argv);
+    REQUIRE(*cached);
+    REQUIRE(cached->args.rest.size() == 4);
+    REQUIRE(cached->args.rest.argv != argv + 4);
+    REQUIRE(cached->args.rest[1] == "-la");
+    REQUIRE(cached->args.rest.argv[4] == nullptr);
+
+    cl::LineParser parser;
+    parser.update("exec -- a -b");
+    REQUIRE(parser.error().code == cl::ErrorCode::NONE);
+    REQUIRE(parser.tokens().size() == 3);
+    REQUIRE(parser.tokens()[1].kind == cl::TokenKind::OPTION);
+    REQUIRE(parser.tokens()[2].kind == cl::TokenKind::ARGUMENT);
+    REQUIRE(parser.tokens()[2].val == "a -b");
+    REQUIRE(parser.args()->rest.line == "a -b");
+
+    parser.update("exec -- a -b --bogus");
+    REQUIRE(parser.error().code == cl::ErrorCode::NONE);
+    REQUIRE(parser.reused == 2);
+    REQUIRE(parser.args()->rest.line == "a -b --bogus");
+
+    // Same results as try_parse() on the line
+    for(std::string l : {R"(exec \-- x'a)", R"(bogus -- x'a)",
+                         R"(exec -en -- x 'a)", R"(exec -en -- -- x'a)",
+                         R"(exec "a)", R"(exec p -- )", R"(exec -en --)"}) {
+        parser.update(l);
+        auto expected = cl::try_parse(l);
+
+        if(expected) {
+            REQUIRE(parser.error().code == cl::ErrorCode::NONE);
+            REQUIRE(parser.args()->rest.line == expected->rest.line);
+        }
+        else {
+            REQUIRE(parser.error().code == expected.error().code);
+            REQUIRE(parser.error().index == expected.error().index);
+        }
+    }
+
+    parser.update("exec -x a -b --bogus");
+    REQUIRE(parser.error().code == cl::ErrorCode::INVALID_OPTION);
+
+    char* words[] = {const_cast<char*>(""), const_cast<char*>("exec"),
+                     const_cast<char*>("--"), const_cast<char*>("--v"),
+                     nullptr};
+
+    REQUIRE(cl::complete(4, words, 3).empty());
+}
+
+TEST_CASE("Rules", "[rules]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    // clang-format off
+    cl::Options{
+        cl::opt("js", "json", "JSON output"),
+        cl::opt("ym", "yaml", "YAML output"),
+        cl::opt("tx", "text", "Text output"),
+        cl::opt("ke", "key"_o, "Private key"),
+        cl::opt("ce", "cert"_o, "Certificate"),
+        cl::opt("ca", "cacert"_o, "CA certificate"),
+        cl::opt("v1", "verbose", "Verbose"),
+    };
+
+    cl::Usage{
+        cl::cmd("show", *--"json"_p, *--"yaml"_p, *--"text"_p, *--"verbose"_p),
+        cl::cmd("connect", *--"key"_p, *--"cert"_p, *--"cacert"_p),
+        cl::cmd("version", *--"verbose"_p),
+    };
+
+    cl::Rules{
+        cl::exactly_one("json", "yaml", "text"),
+        cl::depends("key", "cert", "cacert"),
+        cl::at_most_one("verbose", "json"),
+    };
+    // clang-format on
+
+    REQUIRE(try_parse_os("show", "--json"));
+    REQUIRE(try_parse_os("show", "-ym", "--yaml"));
+    REQUIRE(try_parse_os("connect"));
+    REQUIRE(try_parse_os("connect", "--cert=c", "--key=k", "--cacert=a"));
+
+    // Rules only apply to the commands allowing their options
+    REQUIRE(try_parse_os("version", "--verbose"));
+
+    auto res = try_parse_os("show", "--verbose", "-tx", "--json");
+    REQUIRE(res.error().code == cl::ErrorCode::CONFLICTING_OPTIONS);
+    REQUIRE(res.error().index == 4);
+    REQUIRE(res.error().token == "--json");
+    REQUIRE(res.error().other == "-tx");
+    REQUIRE(res.error().message() == "Option '--json' conflicts with '-tx'");
+
+    res = try_parse_os("show", "--yaml", "--verbose", "--json");
+    REQUIRE(res.error().code == cl::ErrorCode::CONFLICTING_OPTIONS);
+    REQUIRE(res.error().other == "--yaml");
+
+    res = try_parse_os("show", "--verbose");
+    REQUIRE(res.error().code == cl::ErrorCode::MISSING_OPTION_GROUP);
+    REQUIRE(res.error().index == 3);
+    REQUIRE(res.error().message() ==
+            "One of '--json', '--yaml', '--text' is required");
+
+    res = try_parse_os("connect", "--cacert=a", "-ke", "k");
+    REQUIRE(res.error().code == cl::ErrorCode::MISSING_DEPENDENCY);
+    REQUIRE(res.error().index == 3);
+    REQUIRE(res.error().token == "-ke");
+    REQUIRE(res.error().message() == "Option '-ke' requires '--cert'");
+
+    // Rules are part of the grammar fingerprint
+    uint64_t fingerprint = cl::impl::layout.fingerprint;
+    cl::Rules{cl::at_least_one("key", "cert")};
+    cl::impl::finalize();
+    REQUIRE(cl::impl::layout.fingerprint != fingerprint);
+    REQUIRE(try_parse_os("connect").error().code ==
+            cl::ErrorCode::MISSING_OPTION_GROUP);
+
+    // A mask spanning several words
+    clear_cl();
+    std::vector<std::string> names;
+
+    for(int i = 0; i < 200; i++)
+        names.push_back("option" + std::to_string(i));
+
+    for(const std::string& n : names)
+        cl::Options::items.emplace_back(n, cl::impl::OptParam{n, true});
+
+    cl::Options::complete();
+    cl::impl::Cmd all{"all"};
+
+    for(const std::string& n : names)
+        all, *--cl::impl::Param{n};
+
+    cl::Usage{all};
+    cl::Rules{cl::at_most_one("option3", "option150", "option199")};
+
+    res = try_parse_os("all", "--option3", "--option100", "--option199");
+    REQUIRE(res.error().code == cl::ErrorCode::CONFLICTING_OPTIONS);
+    REQUIRE(res.error().token == "--option199");
+    REQUIRE(try_parse_os("all", "--option150", "--option100"));
+}
+
+TEST_CASE("Lazy defaults", "[defaults]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    int calls = 0;
+
+    auto probe = [&calls] {
+        ++calls;
+        return std::string(40, 'x'); // Not a small string
+    };
+
+    cl::Options{
+        cl::opt("j", "jobs"_o, "Jobs", [&calls] {
+            ++calls;
+            return std::string{"8"};
+        }),
+        cl::opt("so", "socket"_o, "Socket directory", probe),
+        cl::opt("v1", "verbose", "Verbose"),
+    };
+
+    cl::Usage{
+        cl::cmd("run", *--"jobs"_p, *--"socket"_p, *--"verbose"_p),
+        cl::cmd("stop"),
+    };
+
+    auto res = try_parse_os("run", "--jobs=2");
+    REQUIRE(res);
+    REQUIRE(calls == 0);
+    REQUIRE((*res)["jobs"] == "2"); // Given, never computed
+    REQUIRE(calls == 0);
+
+    res = try_parse_os("run", "-v1");
+    REQUIRE(res);
+    REQUIRE(calls == 0);
+    REQUIRE((*res)["jobs"] == "8");
+    REQUIRE(calls == 1);
+    REQUIRE((*res)["jobs"] == "8"); // Cached
+    REQUIRE(calls == 1);
+
+    // Copies share the computed values
+    cl::Args copy = *res;
+    res = try_parse_os("stop");
+    REQUIRE(copy["jobs"] == "8");
+
+    // Not an option of the command
+    REQUIRE(res);
+    REQUIRE_FALSE((*res)["jobs"]);
+    REQUIRE(calls == 1);
+
+    const cl::Args& args = copy;
+    REQUIRE(args["socket"] == std::string(40, 'x'));
+    REQUIRE(calls == 2);
+
+    // Iterating reads every value
+    copy = *try_parse_os("run");
+    size_t strings = 0;
+
+    for(const auto& [k, v] : std::as_const(copy))
+        strings += v.is_string();
+
+    REQUIRE(strings == 3); // The command too
+    REQUIRE(calls == 4);
+
+    cl::ParseCache cache{64 * 1024};
+    std::string line = "run";
+    cl::CachedResult cached = cache.try_parse(line);
+    REQUIRE(calls == 6); // Resolved before sharing
+    REQUIRE(cached->args["socket"] == std::string(40, 'x'));
+    REQUIRE(calls == 6);
+}
+
+TEST_CASE("Validators", "[validators]") {
+    clear_cl();
+    cl::help_on_exit = false;
+
+    std::atomic<size_t> calls{0};
+
+    auto path = [&calls](std::string_view v) -> std::string {
+        ++calls;
+
+        if(v == "/boom")
+            throw std::runtime_error{"boom"};
+        if(v.empty() || v.front() != '/')
+            return "not an absolute path";
+        return {};
+    };
+
+    auto number = [](std::string_view v) -> std::string {
+        bool ok = !v.empty() && std::all_of(v.begin(), v.end(), [](char ch) {
+            return ch >= '0' && ch <= '9';
+        });
+
+        return ok ? std::string{} : std::string{"not a number"};
+    };
+
+    cl::Options{
+        cl::opt("j", "jobs"_o, "Jobs"),
+        cl::opt("v1", "verbose", "Verbose"),
+    };
+
+    cl::Usage{
+        cl::cmd("copy", "dest"_p >> path, *--"jobs"_p >> number,
+                *--"verbose"_p, cl::rest(path)),
+        cl::cmd("list", *"dir"_p),
+    };
+
+    // The first rejected value
+    auto res = try_parse_os("copy", "/tmp", "--jobs=x");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().code == cl::ErrorCode::INVALID_VALUE);
+    REQUIRE(res.error().token == "x");
+
+    res = try_parse_os("copy", "tmp", "--jobs=2");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().index == 2);
+
+    res = try_parse_os("copy", "/tmp", "--jobs=2", "--", "/a", "b");
+    REQUIRE_FALSE(res);
+    REQUIRE(res.error().index == 6);
+    REQUIRE(res.error().message() == "Invalid value 'b': not an absolute path");
+
+    cl::LineParser editor;
+    REQUIRE(editor.update("copy tmp").code == cl::ErrorCode::INVALID_VALUE);
+    REQUIRE(editor.error().index == 2);
+    REQUIRE(editor.error().reason == "not an absolute path");
+    REQUIRE(editor.update("copy /tmp").code == cl::ErrorCode::NONE);
+
+    // Not checked: commands without validators and missing values
+    REQUIRE(try_parse_os("list", "dir"));
+    REQUIRE(try_parse_os("copy", "/tmp", "-v1"));
+
+    // Not cached, validators run on every parse
+    cl::ParseCache cache{64 * 1024};
+    calls = 0;
+
+    cl::CachedResult copy = cache.try_parse("copy /tmp");
+    REQUIRE(*copy);
+    REQUIRE(cache.try_parse("copy /tmp") != copy);
+    REQUIRE(calls == 2);
+    REQUIRE_FALSE(*cache.try_parse("copy tmp"));
+    REQUIRE(cache.try_parse("list dir") == cache.try_parse("list dir"));
+    REQUIRE(cache.stats().entries == 1);
+
+    std::vector<std::string> words = {"", "copy", "/tmp", "--"};
+
+    for(size_t i = 0; i < 1000; i++)
+        words.push_back(i % 100 == 7 ? "rel" : "/abs" + std::to_string(i));
+
+    std::vector<char*> argv;
+
+    for(std::string& w : words)
+        argv.push_back(w.data());
+
+    argv.push_back(nullptr);
+    auto argc = static_cast<int>(words.size());
+
+    for(size_t threshold : {size_t{1}, size_t{100000}}) {
+        cl::ValidatingParser parser{4, threshold};
+        cl::ValidationReport report;
+        calls = 0;
+
+        res = parser.try_parse(argc, argv.data(), report);
+        REQUIRE_FALSE(res);
+        REQUIRE(calls == 1001);
+        REQUIRE(report.failures.size() == 10);
+        REQUIRE(res.error().index == 11);
+
+        for(size_t i = 0; i < report.failures.size(); i++) {
+            REQUIRE(report.failures[i].index == static_cast<int>(i * 100 + 11));
+            REQUIRE(report.failures[i].token == "rel");
+            REQUIRE(report.failures[i].reason == "not an absolute path");
+        }
+
+        REQUIRE(report.message().rfind(
+                    "Invalid value 'rel': not an absolute path\n", 0) == 0);
+    }
+
+    // Every rejected value, sorted by index
+    cl::ValidatingParser parser{2, 1};
+    cl::ValidationReport report;
+
+    // Exceptions of validators reach the caller
+    char* boom[] = {argv[0], argv[1], argv[2], argv[3], argv[4],
+                    const_cast<char*>("/boom"), nullptr};
+
+    REQUIRE_THROWS_AS(parser.try_parse(6, boom, report), std::runtime_error);
+    std::string line = "copy --jobs=x tmp -- /a b";
+
+    res = parser.try_parse(line, report);
+    REQUIRE_FALSE(res);
+    REQUIRE(report.failures.size() == 2); // A line has no argv after '--'
+    REQUIRE(report.failures[0].token == "x");
+    REQUIRE(report.failures[1].token == "tmp");
+
+    words.resize(4);
+    argv.clear();
+
+    for(std::string& w : words)
+        argv.push_back(w.data());
+
+    int entered = 0;
+    cl::Usage::items[0] >> [&entered](const cl::Args&) { ++entered; };
+
+    res = parser.try_parse(4, argv.data(), report);
+    REQUIRE(res);
+    REQUIRE(report.empty());
+    REQUIRE(entered == 1);
+}